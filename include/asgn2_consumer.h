@@ -0,0 +1,63 @@
+#ifndef __ASGN2_CONSUMER_H__
+#define __ASGN2_CONSUMER_H__
+
+# include <linux/scatterlist.h>
+
+# include "asgn2_ioctl.h"
+
+/**
+ * The API for the other modules to receive the messages of the device in kernel.
+ *
+ * A registered consumer owns the device like a process which opens the device 
+ * for reading, so only one of them can read the messages at a time. Each completed 
+ * message (the data before a delimiter) is delivered in place as a scatterlist 
+ * of the fragments in the buffer, nothing is copied.
+ */
+struct asgn2_consumer {
+    /**
+     * called in process context for each completed message, the message is 
+     * `record->size` bytes in the `nents` entries of `sg`, `record` also carries its 
+     * CRC32 and flags, all of them are only valid during the call. 
+     * the messages which lost some data are dropped before they are delivered. 
+     * it may unregister the consumer, which is not called again after it returns, 
+     * but it must not register a consumer or a route, which waits for the lock 
+     * held during the call
+     * @return: 0 consumes the message, 
+     *          otherwise the message is kept and delivered again after 
+     *          `asgn2_consumer_kick` is called or more data arrives
+     */
+    int (*deliver)(struct asgn2_consumer * consumer, struct scatterlist * sg, 
+            int nents, const struct asgn2_record_info * record);
+
+    // free for the owner of the consumer
+    void * private;
+};
+
+/**
+ * @return: 0 means registered, -EBUSY means the device is owned by others
+ */
+int asgn2_register_consumer(struct asgn2_consumer * consumer);
+
+/**
+ * the consumer is never called after it returns, 
+ * or after `deliver` returns if it is called from there
+ */
+void asgn2_unregister_consumer(struct asgn2_consumer * consumer);
+
+/**
+ * deliver the messages which the consumer hasn't accepted again
+ */
+void asgn2_consumer_kick(void);
+
+/**
+ * A consumer registered as the route doesn't own the device, it only receives 
+ * the messages which the attached filter routes to it (`ASGN2_FILTER_ROUTE`), 
+ * and works alongside the owner of the device. The messages it refuses are 
+ * dropped instead of being delivered again.
+ * @return: 0 means registered, -EBUSY means another route has been registered
+ */
+int asgn2_register_route(struct asgn2_consumer * consumer);
+
+void asgn2_unregister_route(struct asgn2_consumer * consumer);
+
+#endif // __ASGN2_CONSUMER_H__
@@ -0,0 +1,83 @@
+#ifndef __ASGN2_IOCTL_H__
+#define __ASGN2_IOCTL_H__
+
+/**
+ * The ioctl commands supported by the device file, shared with user programs
+ */
+# include <linux/ioctl.h>
+# include <linux/types.h>
+
+#define ASGN2_IOC_MAGIC 'a'
+
+// the minimum number of bytes a blocked read waits for, 
+// a completed message or the max delay still wakes the reader up earlier
+#define ASGN2_IOC_SET_LOWAT _IOW(ASGN2_IOC_MAGIC, 1, int)
+#define ASGN2_IOC_GET_LOWAT _IOR(ASGN2_IOC_MAGIC, 2, int)
+
+// flags of the reading mode
+// once a message has been read completely, a read returns 0 to report the end of it, 
+// and the following reads continue with the next message
+#define ASGN2_MODE_STREAM 0x1
+
+#define ASGN2_IOC_SET_MODE _IOW(ASGN2_IOC_MAGIC, 3, int)
+#define ASGN2_IOC_GET_MODE _IOR(ASGN2_IOC_MAGIC, 4, int)
+
+// move to the next message after the current one has been read completely, 
+// fails with EAGAIN if there is still some data or the delimiter hasn't arrived
+#define ASGN2_IOC_NEXT_MESSAGE _IO(ASGN2_IOC_MAGIC, 5)
+
+// attach the BPF socket filter program of the fd to the device, which runs on 
+// each completed message before it is delivered, a negative fd detaches it, 
+// fails with EPERM if the file doesn't own the device (e.g., opened only for writing), 
+// or EOPNOTSUPP if the kernel doesn't support BPF
+#define ASGN2_IOC_SET_FILTER _IOW(ASGN2_IOC_MAGIC, 6, int)
+
+// the verdicts returned by the filter program, 
+// the message is dropped without being copied to anyone
+#define ASGN2_FILTER_DROP 0
+// the message is delivered to the in-kernel consumer registered as the route, 
+// it is dropped if there is no such consumer or the consumer refuses it
+#define ASGN2_FILTER_ROUTE 1
+// the message is delivered to the owner of the device, any other value means the same
+#define ASGN2_FILTER_DELIVER 2
+
+// the metadata of the last message the device has moved past, i.e. the one which 
+// a read has reported the end of in stream mode, or `ASGN2_IOC_NEXT_MESSAGE` has ended
+struct asgn2_record_info {
+    // size of the message, the delimiter is not included
+    __u64 size;
+    // CRC32 of the message, the same as zlib's `crc32()`
+    __u32 crc;
+    // `ASGN2_RECORD_*`
+    __u32 flags;
+};
+
+// some data of the message has been lost, only reported when the framing is enabled
+#define ASGN2_RECORD_CORRUPT 0x1
+
+// fails with ENODATA if no message has been ended yet
+#define ASGN2_IOC_GET_RECORD_INFO _IOR(ASGN2_IOC_MAGIC, 7, struct asgn2_record_info)
+
+// what to drop without reading it
+// `count` bytes from the next byte, the delimiters are counted as well
+#define ASGN2_DISCARD_BYTES 0
+// the rest of the current message and its delimiter, `count` is ignored, 
+// only the data received so far is dropped if the delimiter hasn't arrived
+#define ASGN2_DISCARD_MESSAGE 1
+// the data up to and including the `count`th next delimiter
+#define ASGN2_DISCARD_MESSAGES 2
+
+struct asgn2_discard {
+    // `ASGN2_DISCARD_*`
+    __u32 mode;
+    __u32 reserved;
+    // the number of the bytes or messages to drop, 
+    // replaced with the number of the bytes dropped
+    __u64 count;
+};
+
+// drop the unread data without copying it, the pages are released directly, 
+// stops at the end of the data received so far instead of waiting for more
+#define ASGN2_IOC_DISCARD _IOWR(ASGN2_IOC_MAGIC, 8, struct asgn2_discard)
+
+#endif // __ASGN2_IOCTL_H__
@@ -0,0 +1,26 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+# include <linux/debugfs.h>
+
+# include "common.h"
+
+/**
+ * The benchmarks are only built with `make BENCH=1`, they are triggered by 
+ * writing parameters into the files in the debugfs directory of the module, 
+ * and the result can be read from the same file
+ */
+#ifdef ASGN2_BENCH
+
+int init_bench(struct dentry * dir);
+
+#else
+
+static inline int init_bench(struct dentry * dir) 
+{
+    return SUCC;
+}
+
+#endif // ASGN2_BENCH
+
+#endif // __BENCH_H__
@@ -8,6 +8,17 @@ typedef struct {
 
 typedef CBuffer* PCBuffer;
 
+// a contiguous piece of data stored in the circular buffer
+typedef struct {
+    char * buff;
+    size_t size;
+} CBufferSegment;
+
+typedef CBufferSegment * PCBufferSegment;
+
+// the data in the circular buffer is stored in at most 2 contiguous pieces
+#define CBUFFER_MAX_SEGMENTS 2
+
 PCBuffer create_new_cbuffer (size_t size);
 
 PCBuffer init_new_cbuffer(void * p, size_t mem_size);
@@ -24,4 +35,8 @@ size_t write_into_cbuffer(PCBuffer cbuff, char * buff, size_t size);
 
 size_t read_from_cbuffer(PCBuffer cbuff, char * buff, size_t size);
 
+size_t cbuffer_get_segments(PCBuffer cbuff, CBufferSegment segs[CBUFFER_MAX_SEGMENTS]);
+
+size_t cbuffer_consume(PCBuffer cbuff, size_t size);
+
 #endif // __cbuffer_H__
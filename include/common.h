@@ -14,27 +14,11 @@
 
 #define DEBUG_BLOCK(x) x
 
-#define spin_lock_wrapper(l) unsigned long __flags; \
-    if (in_interrupt()) {\
-        D(TAG, "Locking " #l); \
-        spin_lock_irqsave((l), __flags);\
-        D(TAG, "Locked " #l);\
-    } else {\
-        D(TAG, "Locking " #l); \
-        spin_lock((l));\
-        D(TAG, "Locked " #l);\
-    }
-
-
-#define spin_unlock_wrapper(l) if (in_interrupt()) {\
-    D(TAG, "Unlocking " #l); \
-    spin_unlock_irqrestore((l), __flags);\
-    D(TAG, "Unlocked " #l);\
-} else {\
-    D(TAG, "Unlocking " #l); \
-    spin_unlock((l));\
-    D(TAG, "Unlocked " #l);\
-}
+#define LOCK_TRACE(l, op, lock_op) do {\
+    D(TAG, op "ing " #l);\
+    lock_op;\
+    D(TAG, op "ed " #l);\
+} while (0)
 
 #else
 
@@ -46,20 +30,44 @@
 
 #define DEBUG_BLOCK(x)
 
-#define spin_lock_wrapper(l) unsigned long __flags; \
-    if (in_interrupt()) {\
-        spin_lock_irqsave((l), __flags);\
-    } else {\
-        spin_lock((l));\
-    }
-
-#define spin_unlock_wrapper(l) if (in_interrupt()) {\
-    spin_unlock_irqrestore((l), __flags);\
-} else {\
-    spin_unlock((l));\
-}
+#define LOCK_TRACE(l, op, lock_op) lock_op
 
 #endif // DEBUG
+
+# include "lock_stat.h"
+
+/**
+ * the primitive of each lock is chosen by the highest context it is shared with, 
+ * when the code is written, instead of checking `in_interrupt()` every time:
+ * - hardirq: also taken by the interrupt handlers (`cbuff_lock`), 
+ *            the local interrupts are disabled while holding it
+ * - softirq: also taken by the tasklet, the timers and the RCU callbacks 
+ *            (the lock of the delimiter buffer, the memory cache and the flow control), 
+ *            the bottom halves are disabled while holding it
+ * - process: only taken in process context (the lock of the device data)
+ * the locks are always taken in this order, and lockdep verifies it with 
+ * CONFIG_PROVE_LOCKING:
+ *   the lock of the delimiter buffer -> the lock of the memory cache
+ * `cbuff_lock`, the lock of the device data and the lock of the flow control 
+ * are never nested with others
+ */
+#define hardirq_lock(l, flags) LOCK_TRACE(l, "Lock", LOCK_STAT_ACQUIRE((l), \
+            spin_trylock_irqsave((l), (flags)), spin_lock_irqsave((l), (flags))))
+#define hardirq_unlock(l, flags) LOCK_TRACE(l, "Unlock", LOCK_STAT_RELEASE((l), \
+            spin_unlock_irqrestore((l), (flags))))
+
+#define softirq_lock(l) LOCK_TRACE(l, "Lock", LOCK_STAT_ACQUIRE((l), \
+            spin_trylock_bh((l)), spin_lock_bh((l))))
+#define softirq_unlock(l) LOCK_TRACE(l, "Unlock", LOCK_STAT_RELEASE((l), spin_unlock_bh((l))))
+
+#define process_lock(l) LOCK_TRACE(l, "Lock", LOCK_STAT_ACQUIRE((l), \
+            spin_trylock((l)), spin_lock((l))))
+#define process_unlock(l) LOCK_TRACE(l, "Unlock", LOCK_STAT_RELEASE((l), spin_unlock((l))))
+
+// the mutex is only taken in process context as well
+#define process_mutex_lock(m) LOCK_TRACE(m, "Lock", LOCK_STAT_ACQUIRE((m), \
+            mutex_trylock((m)), mutex_lock((m))))
+#define process_mutex_unlock(m) LOCK_TRACE(m, "Unlock", LOCK_STAT_RELEASE((m), mutex_unlock((m))))
        
 #define currentpid current->pid
 
@@ -1,23 +1,99 @@
 #ifndef __DELIMITER_BUFFER_H__
 #define __DELIMITER_BUFFER_H__
 
+# include "circular_buffer.h"
+# include "page_buffer.h"
+
 typedef struct {
 } DelimiterBuffer;
 
 typedef DelimiterBuffer * PDBuffer;
 
+// the flags of the record info
+// the delimiter of the record has been recognised, so the size and CRC are final
+# define DBUFFER_RECORD_COMPLETED 0x1
+// some data of the record has been lost
+# define DBUFFER_RECORD_CORRUPT 0x2
+
+typedef struct {
+    // size of all the data of the record, including the data which has been read
+    size_t size;
+    // CRC32 (the same as zlib) of the data
+    u32 crc;
+    unsigned int flags;
+} DBufferRecordInfo;
+
+typedef DBufferRecordInfo * PDBufferRecordInfo;
+
 PDBuffer create_new_dbuffer(void);
 
 void release_dbuffer(PDBuffer buff);
 
 size_t write_into_dbuffer(PDBuffer pb, void * buff, size_t size);
 
+size_t write_segments_into_dbuffer(PDBuffer pb, 
+        CBufferSegment segs[CBUFFER_MAX_SEGMENTS]);
+
+size_t dbuffer_reserve_read(PDBuffer pb, size_t size);
+
+void dbuffer_commit_read(PDBuffer pb, size_t size);
+
 size_t read_from_dbuffer(PDBuffer pb, void * buff, size_t size);
 
 size_t read_from_dbuffer_to_user(PDBuffer pb, void __user * buff, size_t size);
 
+/**
+ * @return: the absolute stream offset of the first unread byte, 
+ *          the offset counts all the bytes ever written, including the delimiters
+ */
+u64 dbuffer_offset(PDBuffer pb);
+
+/**
+ * the range of the data [start, end) (absolute offsets) which `dbuffer_read_at` can read
+ */
+void dbuffer_window(PDBuffer pb, u64 * start, u64 * end);
+
+/**
+ * copy the raw data (including the delimiters) at the absolute stream `offset` 
+ * into user space without consuming it, the readers are not serialised
+ * @return: size of the data copied, 0 at the end of the data, 
+ *          -ENODATA if the data at `offset` has been released
+ */
+ssize_t dbuffer_read_at(PDBuffer pb, u64 offset, void __user * buff, size_t size);
+
 int dbuffer_contains_data(PDBuffer pb);
 
-void dbuffer_end_phase_reading(PDBuffer pb);
+/**
+ * size of all the buffered data, including the delimiters and the data of 
+ * the following messages, it doesn't take the lock
+ */
+size_t dbuffer_size(PDBuffer pb);
+
+int dbuffer_record_completed(PDBuffer pb);
+
+int dbuffer_end_phase_reading(PDBuffer pb);
+
+/**
+ * drop the unread data without copying it, until `size` bytes (the delimiters are 
+ * counted as well) or `*messages` delimiters have been dropped, pass -1 for no limit, 
+ * stops at the end of the data, fails if some data is reserved for reading
+ * @return: size of the data dropped, and the number of the delimiters is stored into `messages`
+ */
+size_t dbuffer_discard(PDBuffer pb, size_t size, size_t * messages);
+
+/**
+ * the metadata of the record being read, the CRC is computed while the data is written
+ */
+void dbuffer_record_info(PDBuffer pb, PDBufferRecordInfo info);
+
+/**
+ * mark the record which holds the byte at the absolute stream `offset` as corrupt, 
+ * the offset counts all the bytes ever written into the buffer
+ */
+void dbuffer_mark_corrupt(PDBuffer pb, u64 offset);
+
+size_t dbuffer_iter_record(PDBuffer pb, PPBufferIter it);
+
+void dbuffer_end_iter(PDBuffer pb, PPBufferIter it);
 
 #endif // __DELIMITER_BUFFER_H__
@@ -0,0 +1,44 @@
+#ifndef __FLOW_CONTROL_H__
+#define __FLOW_CONTROL_H__
+
+# include <linux/debugfs.h>
+
+# include "gpio_reader.h"
+
+/**
+ * The backpressure towards the sender, an output GPIO line is driven low to
+ * pause the sender once the buffered data reaches the high watermark, and driven
+ * high again to resume it after the data drops to the low watermark.
+ *
+ * Without a GPIO reader (e.g., in loopback mode) the line is driven in a fake
+ * register, which is shown in debugfs with the statistics of the pauses.
+ */
+typedef struct {
+} FlowControl;
+
+typedef FlowControl * PFlowControl;
+
+/**
+ * @param reader: the GPIO device to drive the line of, NULL for the fake register
+ * @param buffered_size: returns the size of the buffered data of `args`, 
+ *                       called in any context, with the lock of the flow control held
+ * @return: NULL if the arguments are invalid or out of memory
+ */
+PFlowControl create_flow_control(PGPIOReader reader, int line, size_t high, size_t low, 
+        size_t (*buffered_size)(void *), void * args);
+
+/**
+ * pause or resume the sender according to the size of the buffered data, which is 
+ * read again once the state is locked, called after the data is buffered or consumed, 
+ * in process or softirq context
+ */
+void update_flow_control(PFlowControl fc);
+
+void init_flow_control_debugfs(PFlowControl fc, struct dentry * dir);
+
+/**
+ * the sender is resumed before the flow control is released
+ */
+void release_flow_control(PFlowControl fc);
+
+#endif // __FLOW_CONTROL_H__
@@ -17,4 +17,17 @@ void release_gpio_reader(PGPIOReader reader);
 
 char read_half_byte_from_reader(PGPIOReader reader);
 
+/**
+ * @return: 1 if the GPIO `line` is configured as an output of the device
+ */
+int is_output_line_of_reader(int line);
+
+/**
+ * drive the output GPIO `line` high (non-zero `value`) or low, 
+ * safe to be called in any context, the line is claimed by the caller
+ * and keeps its last level when the reader is released
+ * @return: SUCC, or -EINVAL if the line isn't an output
+ */
+int write_line_of_reader(PGPIOReader reader, int line, int value);
+
 #endif  // __GPIO_READER_H__
@@ -0,0 +1,60 @@
+#ifndef __LOCK_STAT_H__
+#define __LOCK_STAT_H__
+
+/**
+ * The lock statistics are only built with `make LOCK_STAT=1`, the registered locks 
+ * record how many times they are acquired and contended, the histogram of the 
+ * waiting time of the contended acquisitions and the histogram of the holding 
+ * time, which are shown in `lock_stat` in the debugfs 
+ * directory of the module. Without it the lock primitives are not changed at all
+ */
+#ifdef ASGN2_LOCK_STAT
+
+# include <linux/ktime.h>
+
+struct dentry;
+
+void lock_stat_register(void * lock, const char * name);
+
+void lock_stat_unregister(void * lock);
+
+void lock_stat_acquired(void * lock, int contended, u64 wait_ns);
+
+void lock_stat_released(void * lock);
+
+int init_lock_stat(struct dentry * dir);
+
+// try to take the lock first, the time spent in `lock_op` is the waiting time
+#define LOCK_STAT_ACQUIRE(l, try_op, lock_op) do {\
+    if (try_op) {\
+        lock_stat_acquired((l), 0, 0);\
+    } else {\
+        u64 __wait_start = ktime_get_ns();\
+        lock_op;\
+        lock_stat_acquired((l), 1, ktime_get_ns() - __wait_start);\
+    }\
+} while (0)
+
+// must be called before the lock is released, the statistics are protected by it
+#define LOCK_STAT_RELEASE(l, unlock_op) do {\
+    lock_stat_released((l));\
+    unlock_op;\
+} while (0)
+
+#else
+
+#define LOCK_STAT_ACQUIRE(l, try_op, lock_op) lock_op
+#define LOCK_STAT_RELEASE(l, unlock_op) unlock_op
+
+static inline void lock_stat_register(void * lock, const char * name) {}
+
+static inline void lock_stat_unregister(void * lock) {}
+
+static inline int init_lock_stat(struct dentry * dir)
+{
+    return 0;
+}
+
+#endif // ASGN2_LOCK_STAT
+
+#endif // __LOCK_STAT_H__
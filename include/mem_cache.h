@@ -1,12 +1,29 @@
 #ifndef __MEM_CACHE_H__
 #define __MEM_CACHE_H__
 
+# include <linux/debugfs.h>
+
+// flags of allocation
+// zero the allocated memory, the memory is not zeroed by default
+#define MEM_ZERO 0x1
+// the caller is able to sleep, so that the memory larger than a page 
+// can be allocated by vmalloc when the higher-order pages are not available
+#define MEM_SLEEPABLE 0x2
+
 int init_mem_cache(void);
 
 void * alloc_mem(int size);
 
+void * alloc_mem_flags(int size, int flags);
+
 void release_mem(void * mem);
 
+void mem_cache_stat(unsigned long * hits, unsigned long * refills, unsigned long * flushes);
+
+unsigned long mem_cache_pages(void);
+
+void init_mem_cache_debugfs(struct dentry * dir);
+
 void release_mem_cache(void);
 
 #endif  // __MEM_CACHE_H__
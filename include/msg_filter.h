@@ -0,0 +1,56 @@
+#ifndef __MSG_FILTER_H__
+#define __MSG_FILTER_H__
+
+# include <linux/err.h>
+
+# include "common.h"
+# include "delimiter_buffer.h"
+# include "asgn2_ioctl.h"
+
+/**
+ * The BPF program which decides what happens to each completed message, the
+ * program is a socket filter, which sees the message as the payload of a packet
+ * built on the fragments in the buffer, its verdicts are `ASGN2_FILTER_*`.
+ *
+ * Only available when the kernel is built with `CONFIG_BPF_SYSCALL`.
+ */
+typedef struct {
+} MsgFilter;
+
+typedef MsgFilter * PMsgFilter;
+
+#ifdef CONFIG_BPF_SYSCALL
+
+/**
+ * @return: the filter of the program `fd` refers to, or ERR_PTR on failure
+ */
+PMsgFilter create_msg_filter(int fd);
+
+/**
+ * run the filter on the completed message at the head of the buffer,
+ * must be called in process context with the reading of the buffer serialised
+ * @return: one of `ASGN2_FILTER_*`
+ */
+int run_msg_filter(PMsgFilter f, PDBuffer pb);
+
+void release_msg_filter(PMsgFilter f);
+
+#else
+
+static inline PMsgFilter create_msg_filter(int fd)
+{
+    return (PMsgFilter) ERR_PTR(-EOPNOTSUPP);
+}
+
+static inline int run_msg_filter(PMsgFilter f, PDBuffer pb)
+{
+    return ASGN2_FILTER_DELIVER;
+}
+
+static inline void release_msg_filter(PMsgFilter f)
+{
+}
+
+#endif // CONFIG_BPF_SYSCALL
+
+#endif // __MSG_FILTER_H__
@@ -1,11 +1,38 @@
 #ifndef __PAGE_BUFFER_H__
 #define __PAGE_BUFFER_H__
 
+struct scatterlist;
+
 typedef struct {
 } PBuffer;
 
 typedef PBuffer * PPBuffer;
 
+// a resumable search in the buffer, which remembers how far the data has been 
+// scanned, so the repeated searches only scan the newly appended data
+typedef struct {
+    // the absolute stream offset up to which the data has been scanned
+    u64 scanned;
+    // the chunk where the last scan stopped and its sequence number, it is only 
+    // a hint, which is used after the chunk is found at `seq` in the index again
+    void * chunk;
+    unsigned long seq;
+} PBufferCursor;
+
+typedef PBufferCursor * PPBufferCursor;
+
+// walks the data of a range in place, fragment by fragment, without copying it
+typedef struct {
+    PBuffer * buffer;
+    // the absolute stream offset of the next fragment and the end of the range
+    u64 pos;
+    u64 end;
+    // the chunk of the next fragment
+    void * chunk;
+} PBufferIter;
+
+typedef PBufferIter * PPBufferIter;
+
 PPBuffer create_new_pbuffer(void);
 
 size_t pbuffer_size(PPBuffer p);
@@ -16,6 +43,35 @@ size_t read_from_pbuffer(PPBuffer p, char * buff, size_t size);
 
 size_t get_from_pbuffer(PPBuffer p, char * buff, size_t size);
 
+size_t get_from_pbuffer_into_user(PPBuffer p, char __user * buff, size_t size);
+
+/**
+ * copy the data at `pos` bytes after the first unread byte without consuming it, 
+ * the chunk holding it is looked up in O(log n) instead of walking from the head
+ */
+size_t get_from_pbuffer_at(PPBuffer p, size_t pos, char * buff, size_t size);
+
+size_t discard_from_pbuffer(PPBuffer p, size_t size);
+
+/**
+ * @return: the absolute stream offset of the first unread byte
+ */
+u64 pbuffer_offset(PPBuffer p);
+
+/**
+ * the data in [start, end) (absolute offsets) can be read with the positional reads, 
+ * which is the unread data and the consumed data kept in the retention window, 
+ * must be called under the same lock as the writer
+ */
+void pbuffer_window(PPBuffer p, u64 * start, u64 * end);
+
+/**
+ * copy the data at the absolute stream `offset` without consuming it, the buffer 
+ * must be pinned since the window is checked, so the data is not released meanwhile
+ */
+size_t get_from_pbuffer_at_offset_into_user(PPBuffer p, u64 offset, 
+        char __user * buff, size_t size);
+
 size_t write_into_pbuffer_from_user (PPBuffer p, char __user * buff, size_t size);
 
 size_t read_from_pbuffer_into_user (PPBuffer p, char __user * buff, size_t size);
@@ -26,6 +82,59 @@ size_t find_in_pbuffer_in_range(PPBuffer p, size_t end,
 size_t find_in_pbuffer(PPBuffer p, size_t start_pos, 
         size_t (*index) (void *, size_t, void *), void *args);
 
+void init_pbuffer_cursor(PPBuffer p, PPBufferCursor c);
+
+/**
+ * find the next target after the position the cursor has scanned, 
+ * returns its position relative to the first unread byte or -1 if not found,
+ * it doesn't need the lock, but the calls with the same cursor must be serialised
+ */
+size_t find_in_pbuffer_with_cursor(PPBuffer p, PPBufferCursor c, 
+        size_t (*index) (void *, size_t, void *), void *args);
+
+/**
+ * the chunks consumed while the buffer is pinned are not released until it is unpinned, 
+ * so the fragments stay valid, must be called under the same lock as the writer
+ */
+void pbuffer_pin(PPBuffer p);
+
+void pbuffer_unpin(PPBuffer p);
+
+/**
+ * must be called under the same lock as the writer
+ * @return: jiffies until the oldest chunk kept in the retention window reaches 
+ *          the time limit, 0 if no chunk is waiting for it (e.g., the window has 
+ *          no time limit, or the buffer is pinned and the unpin checks it)
+ */
+unsigned long pbuffer_reclaim_delay(PPBuffer p);
+
+/**
+ * release the consumed chunks out of the retention window, 
+ * must be called under the same lock as the writer
+ * @return: the same as `pbuffer_reclaim_delay` after the release
+ */
+unsigned long pbuffer_reclaim(PPBuffer p);
+
+/**
+ * start to walk the `size` bytes at `pos` bytes after the first unread byte, 
+ * the buffer is pinned until `release_pbuffer_iter`, both must be called under 
+ * the same lock as the writer, while the fragments can be walked without the lock
+ */
+void init_pbuffer_iter(PPBuffer p, PPBufferIter it, size_t pos, size_t size);
+
+/**
+ * @return: 1 means the next fragment is stored into `ptr` and `len`, 0 means the end
+ */
+int pbuffer_iter_next(PPBufferIter it, void ** ptr, size_t * len);
+
+/**
+ * fill at most `nents` entries of the scatterlist with the next fragments
+ * @return: the number of the entries filled, the last one is marked as the end
+ */
+int pbuffer_iter_to_sg(PPBufferIter it, struct scatterlist * sg, int nents);
+
+void release_pbuffer_iter(PPBufferIter it);
+
 size_t simple_char_index(void * buff, size_t size, void *arg);
 
 void release_pbuffer(PPBuffer p);
@@ -19,18 +19,32 @@
 # include <linux/sched.h> // for macro `current` to get current process info
 # include <linux/spinlock.h> // for spinlock_t and related functions
 # include <linux/mutex.h>
+# include <linux/timer.h>
+# include <linux/hrtimer.h>
+# include <linux/ktime.h>
+# include <linux/version.h>
+# include <linux/debugfs.h>
+# include <linux/uio.h> // for `iov_iter`
+# include <linux/workqueue.h>
+# include <linux/scatterlist.h>
+# include <linux/seq_file.h>
+# include <linux/limits.h> // for `SIZE_MAX`
 
 # include "common.h"
 # include "circular_buffer.h"
 # include "delimiter_buffer.h"
 # include "gpio_reader.h"
 # include "mem_cache.h"
+# include "asgn2_ioctl.h"
+# include "asgn2_consumer.h"
+# include "msg_filter.h"
+# include "flow_control.h"
+# include "bench.h"
 
 #define D_NAME "asgn2"
 #define TAG "asgn2"
 #define C_NAME "assignment_class"
 
-#define C_BUFFER_SIZE 30
 
 static const char DELIMITER = '\0';
 
@@ -38,6 +52,55 @@ static int major = 0;
 module_param(major, int, S_IRUGO);
 
 MODULE_PARM_DESC(major, "device major number");
+
+static int c_buffer_size = 30;
+module_param_named(cbuffer_size, c_buffer_size, int, S_IRUGO);
+MODULE_PARM_DESC(cbuffer_size, "size of the circular buffer which the interrupt handler writes into");
+
+static int read_lowat = 1;
+module_param(read_lowat, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(read_lowat, "default number of bytes a blocked read waits for");
+
+static int read_max_delay = 10;
+module_param(read_max_delay, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(read_max_delay, "max milliseconds buffered data waits for the read low watermark");
+
+static int flush_residency = 1000;
+module_param(flush_residency, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(flush_residency, "max microseconds a byte stays in the circular buffer, 0 to disable");
+
+static int drain_fill_percent = 50;
+module_param(drain_fill_percent, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(drain_fill_percent, "percentage of the circular buffer filled to trigger the drain");
+
+static bool loopback = false;
+module_param(loopback, bool, S_IRUGO);
+MODULE_PARM_DESC(loopback, "read the data written into the device instead of the GPIO device");
+
+static int flow_high = 1 << 20;
+module_param(flow_high, int, S_IRUGO);
+MODULE_PARM_DESC(flow_high, "buffered bytes to pause the sender at, 0 to disable the flow control");
+
+static int flow_low = 1 << 18;
+module_param(flow_low, int, S_IRUGO);
+MODULE_PARM_DESC(flow_low, "buffered bytes to resume the paused sender at");
+
+static int flow_line = 25;
+module_param(flow_line, int, S_IRUGO);
+MODULE_PARM_DESC(flow_line, "output GPIO driven low to pause the sender, one of 8, 18, 23 and 25");
+
+static int frame_gap_us = 0;
+module_param(frame_gap_us, int, S_IRUGO);
+MODULE_PARM_DESC(frame_gap_us, "microseconds between two nibbles which never happens inside a byte, "
+        "a longer gap there means a nibble was lost, 0 to disable the framing");
+
+// how much data written into the device is copied from user space each time
+# define WRITE_BATCH_SIZE PAGE_SIZE
+
+// the device is owned by the in-kernel consumer instead of a process
+# define CONSUMER_PID 0
+// the messages with more fragments allocate the scatterlist instead of using the stack
+# define CONSUMER_STACK_FRAGS 8
 MODULE_AUTHOR("Jiasheng Li");
 MODULE_LICENSE("GPL");
 
@@ -47,8 +110,16 @@ typedef struct {
     struct device *device;
     struct cdev dev;
 
+    // directory in debugfs for statistics and benchmarks
+    struct dentry *debugfs;
+
     // mutex for reading
     struct mutex mutex_lock;
+    // mutex for writing in loopback mode, so the writes are never interleaved
+    struct mutex write_lock;
+    // the data written is copied from user space through it, protected by `write_lock`, 
+    // allocated once instead of for each write, as it is larger than a cache page
+    char * write_batch;
 
     // wait queue for those processes open the file as read-only or read-write
     wait_queue_head_t wait_queue;
@@ -56,7 +127,7 @@ typedef struct {
     // wait queue for those processes try to read but there is no data in the buffer
     wait_queue_head_t read_queue;
 
-    // spin lock to protect count and write_only_count
+    // spin lock to protect current_pid, only taken in process context
     spinlock_t lock;
 
     // current using process id
@@ -68,10 +139,18 @@ typedef struct {
     // if there are some process waiting to read
     atomic_t waiting_for_read;
 
+    // low watermark of the process reading currently
+    atomic_t read_lowat;
+    // wakes up the reader when the data stays below the low watermark for too long
+    struct timer_list read_timer;
+    // flag indicates if the data has waited for the low watermark too long
+    atomic_t read_timer_expired;
+
     // circular buffer which interrupt handler read data into
     // and tasklet read data from
     PCBuffer c_buff;
-    // used to synchronise between interrupt and tasklet
+    // used to synchronise between interrupt and tasklet, 
+    // always taken with the interrupts disabled
     spinlock_t cbuff_lock;
 
     // encapsulate the operations of gpio, used to read data from gpio
@@ -84,111 +163,665 @@ typedef struct {
     // flag indicates if the tasklet has been started
     int tasklet_running;
 
+    // when the last nibble arrived, only tracked when the framing is enabled
+    ktime_t last_nibble;
+    // number of the bytes written into the circular buffer ever, 
+    // which is the stream offset of the next byte, protected by `cbuff_lock`
+    u64 ingested;
+    // the stream offset where the data was lost, 
+    // waiting for the tasklet to mark the message, protected by `cbuff_lock`
+    int desync_pending;
+    u64 desync_offset;
+
     // the tasklet which migrate data from circular buffer to page buffer
     struct tasklet_struct cbuffer_tasklet;
+
+    // triggers the tasklet when the oldest byte stays in the circular buffer too long
+    struct hrtimer flush_timer;
+
+    // the in-kernel consumer which owns the device, protected by `mutex_lock`
+    struct asgn2_consumer * consumer;
+    // delivers the completed messages to the consumer in process context
+    struct work_struct consumer_work;
+    // the task calling `deliver` of a consumer, set with `mutex_lock` held, 
+    // so a consumer unregistering itself from the callback is recognised
+    struct task_struct * delivering;
+
+    // the data and messages consumed by the readers and the in-kernel consumer
+    atomic64_t read_bytes;
+    atomic64_t read_messages;
+    // the data dropped with `ASGN2_IOC_DISCARD`
+    atomic64_t discarded_bytes;
+    // how many times the consumer has refused to accept a message
+    atomic64_t consumer_deferred;
+
+    // the filter of the completed messages and the consumer which it routes 
+    // the messages to, both protected by `mutex_lock`
+    PMsgFilter filter;
+    struct asgn2_consumer * route;
+    // flag indicates if the message at the head has passed the filter
+    int head_filtered;
+    // the messages dropped and routed by the filter
+    atomic64_t filter_dropped;
+    atomic64_t filter_routed;
+
+    // pauses the sender when too much data is buffered, NULL if disabled
+    PFlowControl flow;
+
+    // the metadata of the last message moved past, protected by `mutex_lock`
+    struct asgn2_record_info last_record;
+    int has_last_record;
+    // how many times the data has been lost and the messages dropped because of it
+    atomic64_t desyncs;
+    atomic64_t corrupt_messages;
 } DevData;
 typedef DevData * PDevData;
 
+// define structure to save the data about each opened file
+typedef struct {
+    // low watermark of reading, at least 1
+    int read_lowat;
+    // flags of the reading mode, e.g., `ASGN2_MODE_STREAM`
+    int mode;
+    // flag indicates if the file has moved to the next message and not read from it yet
+    int advanced;
+    // flag indicates if the file owns the device, the write-only files don't
+    int owner;
+    // the absolute stream offset the file consumed the data up to, the reads at 
+    // other positions (after `llseek` or `pread`) don't consume the data
+    loff_t pos;
+} FileData;
+typedef FileData * PFileData;
+
 // declare data for module
 static PDevData d_data;
 
 // function to change the access permissions of the deivce file
 static char *asgn2_class_devnode(const struct device *dev, umode_t *mode)
 {
+    // everyone is able to write into the device in loopback mode
     if (mode)
-        *mode = 0444;
+        *mode = loopback ? 0666 : 0444;
     return NULL;
 }
 
-static void migration_tasklet(unsigned long data) 
+/**
+ * pause or resume the sender after the data is buffered or consumed
+ */
+static size_t buffered_size(void * args)
 {
-    D(TAG, "The tasklet has been triggered");
-    int buff_size = 10;
-    char * tmpbuffer = (char *) alloc_mem(buff_size * sizeof(char));
-    if (NULL == tmpbuffer) {
-        E(TAG, "Unable to allocate memory to migrate data from circular "
-                "buffer to page buffer");
+    return dbuffer_size((PDBuffer) args);
+}
+
+static inline void update_flow(void)
+{
+    update_flow_control(d_data->flow);
+}
+
+/**
+ * wake up the reader after new data is appended to the page buffer, the wakeups are 
+ * coalesced until the low watermark is reached or the message is completed
+ */
+static void notify_reader(void)
+{
+    if (READ_ONCE(d_data->consumer)) {
+        // the in-kernel consumer only receives the completed messages
+        if (dbuffer_record_completed(d_data->p_buff)) {
+            schedule_work(&d_data->consumer_work);
+        }
         return;
-    } else {
-        D(TAG, "Allocated memory successfully: %lu", P2L(tmpbuffer));
     }
 
+    int data_size = dbuffer_contains_data(d_data->p_buff);
+    if (data_size < 0 || data_size >= atomic_read(&d_data->read_lowat) 
+            || dbuffer_record_completed(d_data->p_buff)) {
+        atomic_set(&d_data->waiting_for_read, 0);
+        wake_up_interruptible_nr(&d_data->read_queue, 1);
+    } else if (!timer_pending(&d_data->read_timer)) {
+        // the reader is woken up later by the timer
+        // if the low watermark isn't reached in time
+        mod_timer(&d_data->read_timer, 
+                jiffies + msecs_to_jiffies(MAX(read_max_delay, 0)));
+    }
+}
+
+/**
+ * cut the segments down to the first `size` bytes
+ * @return: size of the data left in the segments
+ */
+static size_t limit_segments(CBufferSegment segs[CBUFFER_MAX_SEGMENTS], size_t size)
+{
+    size_t total_size = 0;
+    for (int i = 0; i < CBUFFER_MAX_SEGMENTS; i++) {
+        segs[i].size = MIN(segs[i].size, size - total_size);
+        total_size += segs[i].size;
+    }
+    return total_size;
+}
+
+static void migration_tasklet(unsigned long data) 
+{
+    D(TAG, "The tasklet has been triggered");
+    CBufferSegment segs[CBUFFER_MAX_SEGMENTS];
+
     size_t read_size = 0;
     size_t total_size = 0;
     size_t write_size = 0;
+    int running = 1;
+    unsigned long flags;
+    int desync_pending = 0;
+    u64 desync_offset = 0;
+    int marked = 0;
 
     do {
-        spin_lock_wrapper(&d_data->cbuff_lock);
-        read_size = read_from_cbuffer(d_data->c_buff, tmpbuffer, buff_size);
-        D(TAG, "read data from circular buffer in the tasklet,"
-                " read size: %d content: %s", read_size, tmpbuffer);
-        if (read_size < buff_size) {
+        // hand the migrated data back to the circular buffer and expose the rest, 
+        // the interrupt handler only appends data behind the exposed segments, 
+        // so they can be migrated without holding the lock
+        hardirq_lock(&d_data->cbuff_lock, flags);
+        cbuffer_consume(d_data->c_buff, write_size);
+        // the stream offset of the first byte in the circular buffer
+        u64 migrated = d_data->ingested - cbuffer_size(d_data->c_buff);
+        if (d_data->desync_pending && d_data->desync_offset <= migrated) {
+            // the data before the lost one has all been migrated, 
+            // so the message it belongs to is in the page buffer
+            desync_pending = 1;
+            desync_offset = d_data->desync_offset;
+            d_data->desync_pending = 0;
+        }
+        if (write_size == read_size) {
+            read_size = cbuffer_get_segments(d_data->c_buff, segs);
+            if (d_data->desync_pending) {
+                // stop at the lost data, the message must be marked before the data 
+                // behind it (e.g., its delimiter) is visible to the readers
+                read_size = limit_segments(segs, d_data->desync_offset - migrated);
+            }
+        } else {
+            // unable to migrate all the data, leave the rest for next time
+            read_size = 0;
+        }
+        if (0 == read_size && !desync_pending) {
             d_data->tasklet_running = 0;
+            running = 0;
+            // nothing is waiting in the circular buffer now
+            if (0 == cbuffer_size(d_data->c_buff)) {
+                hrtimer_try_to_cancel(&d_data->flush_timer);
+            }
         }
-        spin_unlock_wrapper(&d_data->cbuff_lock);
+        hardirq_unlock(&d_data->cbuff_lock, flags);
 
-        write_size = write_into_dbuffer(d_data->p_buff, tmpbuffer, read_size);
-        D(TAG, "Migrated %d bytes into the page buffer", read_size);
-        total_size += write_size;
-    } while (read_size == buff_size && read_size == write_size);
+        if (desync_pending) {
+            // a noisy line may desync on every message, don't flood the log
+            if (printk_ratelimit()) {
+                W(TAG, "Lost data at offset %lld, resynchronise at the next delimiter", 
+                        desync_offset);
+            }
+            dbuffer_mark_corrupt(d_data->p_buff, desync_offset);
+            desync_pending = 0;
+            marked = 1;
+        }
+
+        write_size = 0;
+        if (read_size > 0) {
+            write_size = write_segments_into_dbuffer(d_data->p_buff, segs);
+            D(TAG, "Migrated %d bytes into the page buffer", write_size);
+            total_size += write_size;
+        }
+    } while (running);
     D(TAG, "Migrated %d bytes into the page buffer totally", total_size);
 
-    if (total_size > 0) {
-        atomic_set(&d_data->waiting_for_read, 0);
+    if (marked && 0 == total_size) {
+        // the reader fails fast instead of waiting for the rest of the message
+        notify_reader();
     }
 
     if (total_size > 0) {
-        wake_up_interruptible_nr(&d_data->read_queue, 1);
+        update_flow();
+        notify_reader();
     }
+}
 
-    release_mem((void *) tmpbuffer);
+static void read_timer_expired(struct timer_list *timer)
+{
+    D(TAG, "The data has waited for the low watermark too long");
+    atomic_set(&d_data->read_timer_expired, 1);
+    atomic_set(&d_data->waiting_for_read, 0);
+    wake_up_interruptible_nr(&d_data->read_queue, 1);
+}
+
+/**
+ * must be called with `cbuff_lock` held
+ */
+static void schedule_migration(void)
+{
+    lockdep_assert_held(&d_data->cbuff_lock);
+    if (!d_data->tasklet_running) {
+        D(TAG, "The tasklet is not running, trigger to migrate data "
+                "in circular buffer to page buffer");
+        d_data->tasklet_running = 1;
+        tasklet_schedule(&d_data->cbuffer_tasklet);
+    }
+}
+
+static enum hrtimer_restart flush_timer_expired(struct hrtimer *timer)
+{
+    D(TAG, "The data has stayed in the circular buffer too long");
+    unsigned long flags;
+    hardirq_lock(&d_data->cbuff_lock, flags);
+    if (cbuffer_size(d_data->c_buff) > 0) {
+        schedule_migration();
+    }
+    hardirq_unlock(&d_data->cbuff_lock, flags);
+    return HRTIMER_NORESTART;
+}
+
+/**
+ * remember where the data was lost, the message holding it is marked 
+ * corrupt by the tasklet, must be called with `cbuff_lock` held
+ */
+static void mark_desync(void)
+{
+    lockdep_assert_held(&d_data->cbuff_lock);
+    atomic64_inc(&d_data->desyncs);
+    // the earliest loss decides the message to mark
+    if (!d_data->desync_pending) {
+        d_data->desync_pending = 1;
+        d_data->desync_offset = d_data->ingested;
+    }
+    schedule_migration();
 }
 
 static irqreturn_t read_trigger(int req, void *dev_id)
 {
     D(TAG, "Trigger the interrupt handler");
     char r = read_half_byte_from_reader(d_data->reader);
+
+    if (frame_gap_us > 0) {
+        ktime_t now = ktime_get();
+        if (d_data->counter % 2 == 1 
+                && ktime_us_delta(now, d_data->last_nibble) > frame_gap_us) {
+            // the sender never pauses inside a byte, so the other half of the 
+            // pending one was lost, drop it and start a new byte with this nibble,
+            // only counted here, the tasklet reports it
+            unsigned long flags;
+            hardirq_lock(&d_data->cbuff_lock, flags);
+            mark_desync();
+            hardirq_unlock(&d_data->cbuff_lock, flags);
+            d_data->counter++;
+        }
+        d_data->last_nibble = now;
+    }
+
     if (d_data->counter % 2 == 0) {
         d_data->half_byte = r;
     } else {
         r = (d_data->half_byte << 4 | r);
 
-        spin_lock_wrapper(&d_data->cbuff_lock);
+        unsigned long flags;
+        hardirq_lock(&d_data->cbuff_lock, flags);
 
-        write_into_cbuffer(d_data->c_buff, &r, 1);
-        if (cbuffer_size(d_data->c_buff) > cbuffer_available_size(d_data->c_buff) 
-                || r == DELIMITER) {
+        if (write_into_cbuffer(d_data->c_buff, &r, 1)) {
+            d_data->ingested++;
+        } else if (frame_gap_us > 0) {
+            // the circular buffer is full, the byte is lost as well
+            mark_desync();
+        }
+        size_t buffered_size = cbuffer_size(d_data->c_buff);
+        size_t total_size = buffered_size + cbuffer_available_size(d_data->c_buff);
+        int fill_percent = clamp(drain_fill_percent, 1, 100);
+        if (buffered_size * 100 >= total_size * fill_percent || r == DELIMITER) {
             D(TAG, "Need to check if tasklet is running");
-            if (!d_data->tasklet_running) {
-                D(TAG, "The tasklet is not running, trigger to migrate data "
-                        "in circular buffer to page buffer");
-                d_data->tasklet_running = 1;
-                tasklet_schedule(&d_data->cbuffer_tasklet);
-            }
+            schedule_migration();
+        } else if (flush_residency > 0 && !d_data->tasklet_running 
+                && !hrtimer_is_queued(&d_data->flush_timer)) {
+            // the timer isn't armed, so the oldest byte in the buffer is this one
+            hrtimer_start(&d_data->flush_timer, us_to_ktime(flush_residency), 
+                    HRTIMER_MODE_REL);
         }
 
-        spin_unlock_wrapper(&d_data->cbuff_lock);
+        hardirq_unlock(&d_data->cbuff_lock, flags);
     }
     d_data->counter ++;
     D(TAG, "Already wrote %d bytes into the circular buffer", d_data->counter / 2);
     return 0;
 }
 
+static void convert_record_info(PDBufferRecordInfo info, struct asgn2_record_info * record)
+{
+    record->size = info->size;
+    record->crc = info->crc;
+    record->flags = (info->flags & DBUFFER_RECORD_CORRUPT) ? ASGN2_RECORD_CORRUPT : 0;
+}
+
+/**
+ * move to the next message and account the one which has been read
+ */
+static void remember_record(PDBufferRecordInfo info)
+{
+    convert_record_info(info, &d_data->last_record);
+    d_data->has_last_record = 1;
+}
+
+static int end_message(void)
+{
+    DBufferRecordInfo info;
+    dbuffer_record_info(d_data->p_buff, &info);
+
+    int ret = dbuffer_end_phase_reading(d_data->p_buff);
+    if (SUCC == ret) {
+        atomic64_inc(&d_data->read_messages);
+        d_data->head_filtered = 0;
+        remember_record(&info);
+    }
+    return ret;
+}
+
+/**
+ * consume the completed message at the head without copying it
+ */
+static void skip_message(void)
+{
+    int size = dbuffer_contains_data(d_data->p_buff);
+    if (size > 0) {
+        size = dbuffer_reserve_read(d_data->p_buff, size);
+        dbuffer_commit_read(d_data->p_buff, size);
+        update_flow();
+    }
+    if (SUCC == dbuffer_end_phase_reading(d_data->p_buff)) {
+        d_data->head_filtered = 0;
+    }
+}
+
+/**
+ * deliver the current message to the consumer in place, 
+ * must be called with `mutex_lock` held
+ * @return: SUCC means the message has been consumed
+ */
+static int deliver_message(struct asgn2_consumer * consumer)
+{
+    struct scatterlist stack_sg[CONSUMER_STACK_FRAGS];
+    struct scatterlist * sg = stack_sg;
+    PBufferIter it;
+    void * ptr;
+    size_t len;
+    int ret = FAIL;
+
+    // the message is completed, so its size and CRC are final
+    DBufferRecordInfo info;
+    struct asgn2_record_info record;
+    dbuffer_record_info(d_data->p_buff, &info);
+    convert_record_info(&info, &record);
+
+    size_t size = dbuffer_iter_record(d_data->p_buff, &it);
+
+    // count the fragments with a copy of the iterator
+    PBufferIter counter = it;
+    int nents = 0;
+    while (pbuffer_iter_next(&counter, &ptr, &len)) nents++;
+
+    if (nents > CONSUMER_STACK_FRAGS) {
+        sg = (struct scatterlist *) alloc_mem_flags(nents * sizeof(struct scatterlist), 
+                MEM_SLEEPABLE);
+        if (!sg) {
+            E(TAG, "Unable to allocate the scatterlist for %d fragments", nents);
+            goto end_iter;
+        }
+    }
+    nents = pbuffer_iter_to_sg(&it, sg, nents);
+
+    WRITE_ONCE(d_data->delivering, current);
+    int refused = consumer->deliver(consumer, sg, nents, &record);
+    WRITE_ONCE(d_data->delivering, NULL);
+    if (refused) {
+        // keep the message until the consumer is able to accept it
+        atomic64_inc(&d_data->consumer_deferred);
+    } else {
+        ret = SUCC;
+    }
+
+    if (sg != stack_sg) release_mem(sg);
+
+end_iter:
+    dbuffer_end_iter(d_data->p_buff, &it);
+    if (SUCC != ret) return FAIL;
+
+    // consume the message and the delimiter behind it
+    size = dbuffer_reserve_read(d_data->p_buff, size);
+    dbuffer_commit_read(d_data->p_buff, size);
+    atomic64_add(size, &d_data->read_bytes);
+    update_flow();
+    return end_message();
+}
+
+/**
+ * drop the message at the head once it is completed if some data of it was lost, 
+ * must be called with `mutex_lock` held
+ * @return: SUCC means the message isn't corrupt, -EAGAIN means it is corrupt but 
+ *          not completed yet, -EBADMSG means it has been dropped
+ */
+static int check_message(void)
+{
+    // the messages are only marked corrupt by the framing
+    if (frame_gap_us <= 0) return SUCC;
+
+    DBufferRecordInfo info;
+    dbuffer_record_info(d_data->p_buff, &info);
+    if (!(info.flags & DBUFFER_RECORD_CORRUPT)) return SUCC;
+    if (!(info.flags & DBUFFER_RECORD_COMPLETED)) return -EAGAIN;
+
+    skip_message();
+    remember_record(&info);
+    atomic64_inc(&d_data->corrupt_messages);
+    return -EBADMSG;
+}
+
+/**
+ * run the filter on the completed message at the head, only once for each message, 
+ * the message dropped or routed by the filter is consumed here, 
+ * must be called with `mutex_lock` held
+ * @return: SUCC means the message is left for the owner of the device
+ */
+static int filter_message(void)
+{
+    if (!d_data->filter || d_data->head_filtered) return SUCC;
+
+    int verdict = run_msg_filter(d_data->filter, d_data->p_buff);
+    if (ASGN2_FILTER_DELIVER == verdict) {
+        d_data->head_filtered = 1;
+        return SUCC;
+    }
+
+    if (ASGN2_FILTER_ROUTE == verdict && d_data->route 
+            && SUCC == deliver_message(d_data->route)) {
+        atomic64_inc(&d_data->filter_routed);
+        return FAIL;
+    }
+    // nobody accepts the message routed by the filter, drop it as well
+    skip_message();
+    atomic64_inc(&d_data->filter_dropped);
+    return FAIL;
+}
+
+static int set_filter(int fd)
+{
+    PMsgFilter filter = NULL;
+    if (fd >= 0) {
+        filter = create_msg_filter(fd);
+        if (IS_ERR(filter)) return PTR_ERR(filter);
+    }
+
+    process_mutex_lock(&d_data->mutex_lock);
+    PMsgFilter old = d_data->filter;
+    d_data->filter = filter;
+    // the message which may be partially read already isn't filtered, 
+    // the filter runs from the next message
+    d_data->head_filtered = 1;
+    process_mutex_unlock(&d_data->mutex_lock);
+
+    release_msg_filter(old);
+    I(TAG, "Process(%d) %s the message filter", currentpid, filter ? "attached" : "detached");
+    return SUCC;
+}
+
+static void consumer_work_fn(struct work_struct * work)
+{
+    process_mutex_lock(&d_data->mutex_lock);
+    while (d_data->consumer && dbuffer_record_completed(d_data->p_buff)) {
+        if (SUCC != check_message() || SUCC != filter_message()) continue;
+        if (SUCC != deliver_message(d_data->consumer)) break;
+    }
+    process_mutex_unlock(&d_data->mutex_lock);
+}
+
+int asgn2_register_consumer(struct asgn2_consumer * consumer)
+{
+    if (!consumer || !consumer->deliver) return -EINVAL;
+
+    // the consumer competes for the device with the processes reading it
+    int ret = -EBUSY;
+    process_lock(&d_data->lock);
+    if (d_data->current_pid < 0) {
+        d_data->current_pid = CONSUMER_PID;
+        ret = SUCC;
+    }
+    process_unlock(&d_data->lock);
+    if (SUCC != ret) return ret;
+
+    process_mutex_lock(&d_data->mutex_lock);
+    WRITE_ONCE(d_data->consumer, consumer);
+    process_mutex_unlock(&d_data->mutex_lock);
+
+    I(TAG, "The in-kernel consumer has been registered");
+    // deliver the messages which have been completed already
+    schedule_work(&d_data->consumer_work);
+    return SUCC;
+}
+EXPORT_SYMBOL_GPL(asgn2_register_consumer);
+
+/**
+ * @return: 1 if called from `deliver`, where `mutex_lock` is held by the caller already
+ */
+static int in_deliver(void)
+{
+    return READ_ONCE(d_data->delivering) == current;
+}
+
+void asgn2_unregister_consumer(struct asgn2_consumer * consumer)
+{
+    int nested = in_deliver();
+    if (!nested) process_mutex_lock(&d_data->mutex_lock);
+    if (d_data->consumer != consumer) {
+        if (!nested) process_mutex_unlock(&d_data->mutex_lock);
+        return;
+    }
+    WRITE_ONCE(d_data->consumer, NULL);
+    if (!nested) {
+        process_mutex_unlock(&d_data->mutex_lock);
+        // the work may be still pending, it finds no consumer then
+        cancel_work_sync(&d_data->consumer_work);
+    }
+    // otherwise the work is running this callback, it must not wait for itself, 
+    // and it stops once the callback returns as no consumer is found
+
+    process_lock(&d_data->lock);
+    d_data->current_pid = -1;
+    process_unlock(&d_data->lock);
+
+    I(TAG, "The in-kernel consumer has been unregistered");
+    wake_up_interruptible_nr(&d_data->wait_queue, 1);
+}
+EXPORT_SYMBOL_GPL(asgn2_unregister_consumer);
+
+void asgn2_consumer_kick(void)
+{
+    if (READ_ONCE(d_data->consumer)) {
+        schedule_work(&d_data->consumer_work);
+    }
+}
+EXPORT_SYMBOL_GPL(asgn2_consumer_kick);
+
+int asgn2_register_route(struct asgn2_consumer * consumer)
+{
+    if (!consumer || !consumer->deliver) return -EINVAL;
+
+    int ret = -EBUSY;
+    process_mutex_lock(&d_data->mutex_lock);
+    if (!d_data->route) {
+        d_data->route = consumer;
+        ret = SUCC;
+    }
+    process_mutex_unlock(&d_data->mutex_lock);
+
+    if (SUCC == ret) I(TAG, "The in-kernel consumer has been registered as the route");
+    return ret;
+}
+EXPORT_SYMBOL_GPL(asgn2_register_route);
+
+void asgn2_unregister_route(struct asgn2_consumer * consumer)
+{
+    // the messages are only routed with `mutex_lock` held
+    int nested = in_deliver();
+    if (!nested) process_mutex_lock(&d_data->mutex_lock);
+    if (d_data->route == consumer) {
+        d_data->route = NULL;
+        I(TAG, "The in-kernel consumer has been unregistered as the route");
+    }
+    if (!nested) process_mutex_unlock(&d_data->mutex_lock);
+}
+EXPORT_SYMBOL_GPL(asgn2_unregister_route);
+
+static int stats_show(struct seq_file * s, void * unused)
+{
+    u64 start, end;
+    dbuffer_window(d_data->p_buff, &start, &end);
+    seq_printf(s, "read_offset: %llu\nwindow_start: %llu\nwindow_end: %llu\n", 
+            dbuffer_offset(d_data->p_buff), start, end);
+    seq_printf(s, "discarded_bytes: %lld\n", atomic64_read(&d_data->discarded_bytes));
+    seq_printf(s, "read_bytes: %lld\nread_messages: %lld\nbuffered_bytes: %d\n"
+            "consumer: %d\nconsumer_deferred: %lld\n"
+            "filter: %d\nfilter_dropped: %lld\nfilter_routed: %lld\n"
+            "desyncs: %lld\ncorrupt_messages: %lld\n", 
+            atomic64_read(&d_data->read_bytes), atomic64_read(&d_data->read_messages), 
+            MAX(dbuffer_contains_data(d_data->p_buff), 0), 
+            READ_ONCE(d_data->consumer) ? 1 : 0, 
+            atomic64_read(&d_data->consumer_deferred), 
+            READ_ONCE(d_data->filter) ? 1 : 0, 
+            atomic64_read(&d_data->filter_dropped), 
+            atomic64_read(&d_data->filter_routed), 
+            atomic64_read(&d_data->desyncs), 
+            atomic64_read(&d_data->corrupt_messages));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
 static int device_open(struct inode *node, struct file *filep)
 {
     D(TAG, "process(%d) try to open the device", currentpid);
     pid_t pid = currentpid;
 
+    PFileData fdata = (PFileData) alloc_mem_flags(sizeof(FileData), MEM_ZERO);
+    if (!fdata) {
+        E(TAG, "Unable to allocate memory for the opened file");
+        return -ENOMEM;
+    }
+    fdata->read_lowat = MAX(read_lowat, 1);
+
+    if (!(filep->f_mode & FMODE_READ)) {
+        // the files only for writing don't compete for the device with the readers
+        filep->private_data = fdata;
+        return SUCC;
+    }
+    fdata->owner = 1;
+
     do {
         int should_wait = 1;
-        spin_lock_wrapper(&d_data->lock);
+        process_lock(&d_data->lock);
         // only when the current running process pid is -1, 
         // the process is permitted to keep going
         if (d_data->current_pid < 0) {
             d_data->current_pid = pid;
             should_wait = 0;
         }
-        spin_unlock_wrapper(&d_data->lock);
+        process_unlock(&d_data->lock);
 
         if (should_wait) {
             D(TAG, "Process(%d) hasn't been granted the resource, keep waiting", pid);
@@ -197,6 +830,7 @@ static int device_open(struct inode *node, struct file *filep)
             D(TAG, "Process(%d) is awake, check what happen", pid);
             if (signal_pending(current)) {
                 D(TAG, "Process(%d) had received an signal, abort the open process", pid);
+                release_mem((void *) fdata);
                 return -ERESTARTSYS;
             }
         } else {
@@ -204,42 +838,119 @@ static int device_open(struct inode *node, struct file *filep)
         }
     } while (true);
     D(D_NAME, "Process(%d) has gained the resource", pid);
+    // the position of the file is the absolute stream offset of the next byte
+    fdata->pos = filep->f_pos = dbuffer_offset(d_data->p_buff);
+    filep->private_data = fdata;
     return SUCC;
 } 
     
 static int device_release(struct inode *node, struct file *filep)
 {
-    dbuffer_end_phase_reading(d_data->p_buff);
+    PFileData fdata = (PFileData) filep->private_data;
+    int owner = fdata->owner;
+    // the file has moved to the next message by itself, 
+    // don't skip the next message which hasn't been read
+    if (owner && !fdata->advanced) {
+        end_message();
+    }
+    release_mem(filep->private_data);
+    filep->private_data = NULL;
+    if (!owner) return 0;
+
     D(D_NAME, "Process(%d) close the device", currentpid);
-    spin_lock_wrapper(&d_data->lock);
+    process_lock(&d_data->lock);
     d_data->current_pid = -1;
-    spin_unlock_wrapper(&d_data->lock);
+    process_unlock(&d_data->lock);
     
     // wake up one of the processes waiting for the resource
     wake_up_interruptible_nr(&d_data->wait_queue, 1);
     return 0;
 }
 
+/**
+ * read the data at the stream offset without consuming it or waiting for it, 
+ * the readers are not serialised, so they can fetch different ranges in parallel
+ */
+static ssize_t read_window(PFileData fdata, char __user * buff, size_t size, loff_t * offset)
+{
+    if (*offset < 0) return -EINVAL;
+
+    // a replay from a checkpoint stops at the position the file consumed up to, 
+    // so the next read continues on the consuming path instead of passing it
+    loff_t pos = READ_ONCE(fdata->pos);
+    if (*offset < pos) {
+        size = MIN(size, (size_t) (pos - *offset));
+    }
+
+    ssize_t read_size = dbuffer_read_at(d_data->p_buff, *offset, buff, size);
+    if (read_size > 0) {
+        *offset += read_size;
+    }
+    return read_size;
+}
+
 static ssize_t device_read(struct file * filep, char __user * buff, 
         size_t size, loff_t * offset)
 {
     D(TAG, "Process(%d) try to read %d bytes data from device", currentpid, size);
+    PFileData fdata = (PFileData) filep->private_data;
+    if (*offset != READ_ONCE(fdata->pos)) {
+        return read_window(fdata, buff, size, offset);
+    }
+
     // in case the file is accessed from multiple processes/threads
-    mutex_lock(&d_data->mutex_lock);
+    process_mutex_lock(&d_data->mutex_lock);
 
     size_t already_read_size = 0;
     if (0 >= size) goto release;
 
     PDevData p = d_data;
 
+    // never wait for more data than the process asks for
+    int lowat = size < fdata->read_lowat ? size : fdata->read_lowat;
+    atomic_set(&p->read_lowat, lowat);
+    // the timer may have expired while nobody was reading, 
+    // only the expiry while this read is waiting lets it return below the low watermark
+    atomic_set(&p->read_timer_expired, 0);
+
 recheck_if_has_data:
     atomic_set(&p->waiting_for_read, 1);
-    // keep waiting until there is some data in the buffer
-    int data_size = dbuffer_contains_data(p->p_buff);
+    // keep waiting until there is enough data in the buffer
+    int data_size;
+    int checked = check_message();
+    if (-EBADMSG == checked) {
+        // fail fast, the reading continues with the next message
+        D(TAG, "Process(%d) dropped the message which lost some data", currentpid);
+        fdata->advanced = 1;
+        already_read_size = -EBADMSG;
+        goto release;
+    } else if (SUCC != checked 
+            || (p->filter && !p->head_filtered && !dbuffer_record_completed(p->p_buff))) {
+        // the corrupt message is dropped and the filter decides, 
+        // both only once the message is completed
+        data_size = 0;
+    } else if (SUCC != filter_message()) {
+        D(TAG, "The message has been dropped or routed by the filter");
+        goto recheck_if_has_data;
+    } else {
+        data_size = dbuffer_contains_data(p->p_buff);
+    }
+
     if (data_size < 0) {
-        // no more data to read, just return
+        // no more data to read before the delimiter, 
+        // the stream mode reports the end of message and continue with the next one
+        if ((fdata->mode & ASGN2_MODE_STREAM) && SUCC == end_message()) {
+            D(TAG, "Process(%d) reached the end of message, move to next", currentpid);
+            fdata->advanced = 1;
+        }
         goto release;
-    } else if (0 == data_size) {
+    } else if (0 == data_size || (data_size < lowat 
+                && !atomic_read(&p->read_timer_expired)
+                && !dbuffer_record_completed(p->p_buff))) {
+        if (data_size > 0 && !timer_pending(&p->read_timer)) {
+            // make sure the data below the low watermark is delivered in time
+            mod_timer(&p->read_timer, jiffies + msecs_to_jiffies(MAX(read_max_delay, 0)));
+        }
         // need to wait
         wait_event_interruptible_exclusive(p->read_queue, 
                 atomic_read(&p->waiting_for_read) == 0);
@@ -254,25 +965,209 @@ recheck_if_has_data:
     // keep going, as there is some data in the buffer
     D(TAG, "There are %d bytes of data in the buffer for read", data_size);
     already_read_size = read_from_dbuffer_to_user(p->p_buff, buff, size);
-
-    *offset += already_read_size;
+    if (already_read_size > 0) {
+        fdata->advanced = 0;
+        atomic64_add(already_read_size, &p->read_bytes);
+        update_flow();
+    }
 
 release:
-    mutex_unlock(&d_data->mutex_lock);
+    // the delimiters and the messages dropped are consumed without being read, 
+    // so the position follows the stream offset instead of the size read
+    *offset = dbuffer_offset(d_data->p_buff);
+    WRITE_ONCE(fdata->pos, *offset);
+    process_mutex_unlock(&d_data->mutex_lock);
 
     return already_read_size;
 }
 
+/**
+ * append the data written into the device to the page buffer in loopback mode, 
+ * the data from all the segments of the iov_iter is written in batches, 
+ * each batch is copied from user space first, so copying never faults with 
+ * the lock of the page buffer held
+ */
+static ssize_t device_write_iter(struct kiocb * iocb, struct iov_iter * from)
+{
+    if (!loopback) return -EPERM;
+    if (0 == iov_iter_count(from)) return 0;
+
+    ssize_t written = 0;
+    process_mutex_lock(&d_data->write_lock);
+    char * batch = d_data->write_batch;
+    while (iov_iter_count(from) > 0) {
+        size_t copied = copy_from_iter(batch, MIN(iov_iter_count(from), WRITE_BATCH_SIZE), from);
+        if (0 == copied) {
+            if (0 == written) written = -EFAULT;
+            break;
+        }
+
+        size_t write_size = write_into_dbuffer(d_data->p_buff, batch, copied);
+        written += write_size;
+        if (write_size < copied) {
+            // unable to allocate memory for the page buffer
+            E(TAG, "Only %d of %d bytes are written into the page buffer", 
+                    write_size, copied);
+            if (0 == written) written = -ENOMEM;
+            break;
+        }
+    }
+    process_mutex_unlock(&d_data->write_lock);
+
+    if (written > 0) {
+        D(TAG, "Process(%d) wrote %d bytes into the device", currentpid, written);
+        update_flow();
+        notify_reader();
+    }
+    return written;
+}
+
+static long discard(struct file * filep, struct asgn2_discard __user * arg)
+{
+    PFileData fdata = (PFileData) filep->private_data;
+    struct asgn2_discard req;
+
+    if (!fdata->owner) return -EPERM;
+    if (copy_from_user(&req, arg, sizeof(req))) return -EFAULT;
+
+    size_t size = -1;
+    size_t messages = -1;
+    switch (req.mode) {
+        case ASGN2_DISCARD_BYTES:
+            size = MIN(req.count, (u64) SIZE_MAX);
+            break;
+        case ASGN2_DISCARD_MESSAGE:
+            messages = 1;
+            break;
+        case ASGN2_DISCARD_MESSAGES:
+            messages = MIN(req.count, (u64) SIZE_MAX);
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    // nothing is reserved for reading while `mutex_lock` is held
+    process_mutex_lock(&d_data->mutex_lock);
+    size = dbuffer_discard(d_data->p_buff, size, &messages);
+    if (messages > 0) {
+        // moved to the other message, which hasn't been filtered or read
+        d_data->head_filtered = 0;
+        fdata->advanced = 1;
+    }
+    fdata->pos = filep->f_pos = dbuffer_offset(d_data->p_buff);
+    process_mutex_unlock(&d_data->mutex_lock);
+
+    D(TAG, "Process(%d) discarded %d bytes and %d messages", currentpid, size, messages);
+    atomic64_add(size, &d_data->discarded_bytes);
+    update_flow();
+
+    req.count = size;
+    return put_user(req.count, &arg->count);
+}
+
+static long device_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+    PFileData fdata = (PFileData) filep->private_data;
+    int __user * p_arg = (int __user *) arg;
+    int value;
+
+    switch (cmd) {
+        case ASGN2_IOC_SET_LOWAT:
+            if (get_user(value, p_arg)) return -EFAULT;
+            if (value < 1) return -EINVAL;
+            fdata->read_lowat = value;
+            D(TAG, "Process(%d) set the low watermark to %d", currentpid, value);
+            return SUCC;
+
+        case ASGN2_IOC_GET_LOWAT:
+            return put_user(fdata->read_lowat, p_arg);
+
+        case ASGN2_IOC_SET_MODE:
+            if (get_user(value, p_arg)) return -EFAULT;
+            if (value & ~ASGN2_MODE_STREAM) return -EINVAL;
+            fdata->mode = value;
+            return SUCC;
+
+        case ASGN2_IOC_GET_MODE:
+            return put_user(fdata->mode, p_arg);
+
+        case ASGN2_IOC_NEXT_MESSAGE:
+            // the files only for writing must not consume the messages of the reader
+            if (!fdata->owner) return -EPERM;
+            // in case the file is being read from other threads
+            process_mutex_lock(&d_data->mutex_lock);
+            value = end_message();
+            if (SUCC == value) {
+                fdata->advanced = 1;
+                // the delimiter has been consumed
+                fdata->pos = filep->f_pos = dbuffer_offset(d_data->p_buff);
+            }
+            process_mutex_unlock(&d_data->mutex_lock);
+            return SUCC == value ? SUCC : -EAGAIN;
+
+        case ASGN2_IOC_GET_RECORD_INFO: {
+            if (!fdata->owner) return -EPERM;
+            process_mutex_lock(&d_data->mutex_lock);
+            struct asgn2_record_info info = d_data->last_record;
+            value = d_data->has_last_record;
+            process_mutex_unlock(&d_data->mutex_lock);
+            if (!value) return -ENODATA;
+            return copy_to_user((void __user *) arg, &info, sizeof(info)) ? -EFAULT : SUCC;
+        }
+
+        case ASGN2_IOC_DISCARD:
+            return discard(filep, (struct asgn2_discard __user *) arg);
+
+        case ASGN2_IOC_SET_FILTER:
+            // the filter applies to all the messages, only the owner is able to change it
+            if (!fdata->owner) return -EPERM;
+            if (get_user(value, p_arg)) return -EFAULT;
+            return set_filter(value);
+
+        default:
+            return -ENOTTY;
+    }
+}
+
+/**
+ * move to the absolute stream offset in the window, the following reads don't consume 
+ * the data until they catch up with the position the file has consumed the data up to
+ */
 static loff_t device_llseek(struct file *filep, loff_t offset, int whence)
 {
-    return -EINVAL;
+    PFileData fdata = (PFileData) filep->private_data;
+    if (!fdata->owner) return -EINVAL;
+
+    u64 start, end;
+    dbuffer_window(d_data->p_buff, &start, &end);
+
+    loff_t pos;
+    switch (whence) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = filep->f_pos + offset;
+            break;
+        case SEEK_END:
+            pos = end + offset;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    if (pos < 0 || pos < start || pos > end) return -EINVAL;
+    filep->f_pos = pos;
+    return pos;
 }
 
 static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = device_open,
     .read = device_read,
+    .write_iter = device_write_iter,
     .llseek = device_llseek,
+    .unlocked_ioctl = device_ioctl,
     .release = device_release,
 };
 
@@ -313,20 +1208,30 @@ static int __init asgn2_init(void)
     init_mem_cache();
 
     // allocate memory to store data
-    d_data = (PDevData) alloc_mem(sizeof(DevData));
+    d_data = (PDevData) alloc_mem_flags(sizeof(DevData), MEM_ZERO | MEM_SLEEPABLE);
     if (!d_data) {
         ret = -ENOMEM;
         E(D_NAME, "failed to allocate memory to store data");
         goto error_with_major;
     }
-    memset(d_data, 0, sizeof(DevData));
     d_data->current_pid = -1;
     atomic_set(&d_data->waiting_for_read, 0);
+    atomic_set(&d_data->read_lowat, 1);
+    atomic_set(&d_data->read_timer_expired, 0);
+    timer_setup(&d_data->read_timer, read_timer_expired, 0);
     init_waitqueue_head(&d_data->wait_queue);
     init_waitqueue_head(&d_data->read_queue);
 
-    // initialise the mutex
+    // initialise the mutex and the locks, each of them has its own lockdep class
     mutex_init(&d_data->mutex_lock);
+    mutex_init(&d_data->write_lock);
+    INIT_WORK(&d_data->consumer_work, consumer_work_fn);
+    spin_lock_init(&d_data->lock);
+    spin_lock_init(&d_data->cbuff_lock);
+    lock_stat_register(&d_data->mutex_lock, "mutex_lock");
+    lock_stat_register(&d_data->lock, "dev_data_lock");
+    lock_stat_register(&d_data->cbuff_lock, "cbuff_lock");
+    lock_stat_register(&d_data->write_lock, "write_lock");
 
     // initialise dev
     cdev_init(&d_data->dev, &fops);
@@ -360,6 +1265,13 @@ static int __init asgn2_init(void)
     D(D_NAME, "create device successfully");
     I(D_NAME, "initialise successfully");
 
+    // debugfs is optional, failing to create it doesn't stop the module
+    d_data->debugfs = debugfs_create_dir(D_NAME, NULL);
+    init_mem_cache_debugfs(d_data->debugfs);
+    init_bench(d_data->debugfs);
+    init_lock_stat(d_data->debugfs);
+    debugfs_create_file("stats", 0400, d_data->debugfs, NULL, &stats_fops);
+
     d_data->p_buff = create_new_dbuffer();
     if (!d_data->p_buff) {
         ret = -EINVAL;
@@ -367,31 +1279,72 @@ static int __init asgn2_init(void)
         goto error_with_device;
     }
 
-    d_data->c_buff = create_new_cbuffer(C_BUFFER_SIZE);
+    d_data->c_buff = create_new_cbuffer(MAX(c_buffer_size, 1));
     if (!d_data->c_buff) {
         ret = -EINVAL;
         E(TAG, "Unable to create circular buffer");
         goto error_with_pbuffer;
     }
 
-    d_data->reader = create_new_gpio_reader(read_trigger);
-    if (!d_data->reader) {
-        ret = -EINVAL;
-        E(TAG, "Unable to create gpio reader");
-        goto error_with_cbuffer;
-    }
+# if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&d_data->flush_timer, flush_timer_expired, CLOCK_MONOTONIC, 
+            HRTIMER_MODE_REL);
+# else
+    hrtimer_init(&d_data->flush_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    d_data->flush_timer.function = flush_timer_expired;
+# endif
+
+    // the tasklet must be ready before the interrupt handler is registered
     tasklet_init(&d_data->cbuffer_tasklet, migration_tasklet, 0);
-    
+
+    if (loopback) {
+        d_data->write_batch = (char *) alloc_mem_flags(WRITE_BATCH_SIZE, MEM_SLEEPABLE);
+        if (!d_data->write_batch) {
+            ret = -ENOMEM;
+            E(TAG, "Unable to allocate the buffer for writing");
+            goto error_with_cbuffer;
+        }
+        I(D_NAME, "Loopback mode, the data written into the device is read back");
+    } else {
+        d_data->reader = create_new_gpio_reader(read_trigger);
+        if (!d_data->reader) {
+            ret = -EINVAL;
+            E(TAG, "Unable to create gpio reader");
+            goto error_with_cbuffer;
+        }
+    }
+
+    // the line is driven in the fake register without the GPIO device
+    if (flow_high > 0) {
+        d_data->flow = create_flow_control(d_data->reader, flow_line, 
+                flow_high, MAX(flow_low, 0), buffered_size, d_data->p_buff);
+        if (!d_data->flow) {
+            ret = -EINVAL;
+            E(TAG, "Unable to create the flow control");
+            goto error_with_reader;
+        }
+        init_flow_control_debugfs(d_data->flow, d_data->debugfs);
+    }
 
     return 0;
 
+error_with_reader:
+    release_gpio_reader(d_data->reader);
+
 error_with_cbuffer:
+    // the interrupts may have scheduled them before the reader was released
+    hrtimer_cancel(&d_data->flush_timer);
+    tasklet_kill(&d_data->cbuffer_tasklet);
+    cancel_work_sync(&d_data->consumer_work);
+    timer_delete_sync(&d_data->read_timer);
+    release_mem(d_data->write_batch);
     release_cbuffer(d_data->c_buff);
 
 error_with_pbuffer:
     release_dbuffer(d_data->p_buff);
 
 error_with_device:
+    debugfs_remove_recursive(d_data->debugfs);
     device_destroy(d_data->clazz, dev_no);
 
 error_with_class:
@@ -401,6 +1354,11 @@ error_with_cdev:
     cdev_del(&d_data->dev);
 
 error_with_data:
+    lock_stat_unregister(&d_data->write_lock);
+    lock_stat_unregister(&d_data->cbuff_lock);
+    lock_stat_unregister(&d_data->lock);
+    lock_stat_unregister(&d_data->mutex_lock);
+    mutex_destroy(&d_data->write_lock);
     mutex_destroy(&d_data->mutex_lock);
     release_mem((void *) d_data);
 
@@ -415,14 +1373,32 @@ static void __exit asgn2_exit(void)
 {
     I(D_NAME, "Byte, module unloaded at 0x%p\n", asgn2_exit);
 
-    tasklet_kill(&d_data->cbuffer_tasklet);
+    // nothing is buffered or consumed while the tasklet is disabled, 
+    // so the sender is resumed for good before the lines are released
+    tasklet_disable(&d_data->cbuffer_tasklet);
+    release_flow_control(d_data->flow);
+    d_data->flow = NULL;
+    tasklet_enable(&d_data->cbuffer_tasklet);
+
     release_gpio_reader(d_data->reader);
+    hrtimer_cancel(&d_data->flush_timer);
+    tasklet_kill(&d_data->cbuffer_tasklet);
+    cancel_work_sync(&d_data->consumer_work);
+    timer_delete_sync(&d_data->read_timer);
+    release_msg_filter(d_data->filter);
+    release_mem(d_data->write_batch);
     release_cbuffer(d_data->c_buff);
     release_dbuffer(d_data->p_buff);
+    debugfs_remove_recursive(d_data->debugfs);
     dev_t dev_no = MKDEV(major, 0);    
     device_destroy(d_data->clazz, dev_no);
     class_destroy(d_data->clazz);
     cdev_del(&d_data->dev);
+    lock_stat_unregister(&d_data->write_lock);
+    lock_stat_unregister(&d_data->cbuff_lock);
+    lock_stat_unregister(&d_data->lock);
+    lock_stat_unregister(&d_data->mutex_lock);
+    mutex_destroy(&d_data->write_lock);
     mutex_destroy(&d_data->mutex_lock);
     release_mem((void *) d_data);
     release_major_number(dev_no);
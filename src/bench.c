@@ -0,0 +1,390 @@
+# include <linux/kernel.h>
+# include <linux/kthread.h>
+# include <linux/completion.h>
+# include <linux/debugfs.h>
+# include <linux/fs.h>
+# include <linux/mutex.h>
+# include <linux/uaccess.h>
+# include <linux/ktime.h>
+# include <linux/slab.h>
+
+# include "common.h"
+# include "mem_cache.h"
+# include "delimiter_buffer.h"
+# include "bench.h"
+
+# define TAG "Bench"
+
+# define MAX_BENCH_THREADS 16
+// how many objects each thread holds at the same time
+# define BENCH_BATCH 32
+# define RESULT_SIZE 512
+// the payload of each message in the message benchmark, the delimiter is not included
+# define MSG_PAYLOAD_SIZE 8
+// how many messages are written before they are read back
+# define MSG_BATCH 256
+// the sizes around a page checked by the boundary test, 
+// which cover the largest memory allocated in a page and the smallest span
+# define BOUNDARY_BELOW 256
+# define BOUNDARY_ABOVE 64
+
+typedef struct {
+    int iterations;
+    unsigned long ops;
+    unsigned long failures;
+    struct completion done;
+} BenchWorker;
+
+typedef BenchWorker * PBenchWorker;
+
+// serialise the benchmarks and protect the result
+static DEFINE_MUTEX(bench_lock);
+
+static char result[RESULT_SIZE];
+
+// mix of the object sizes used by the buffers of the module
+static const int object_sizes[] = { 16, 24, 40, 64, 100, 200, 480, 1000 };
+
+static int _mem_bench_worker(void * data)
+{
+    PBenchWorker w = (PBenchWorker) data;
+    void * objects[BENCH_BATCH];
+
+    for (int i = 0; i < w->iterations; i++) {
+        for (int j = 0; j < BENCH_BATCH; j++) {
+            objects[j] = alloc_mem(object_sizes[(i + j) % ARRAY_SIZE(object_sizes)]);
+            if (NULL == objects[j]) w->failures++;
+        }
+        // release in reversed order, as the buffers usually do
+        for (int j = BENCH_BATCH - 1; j >= 0; j--) {
+            release_mem(objects[j]);
+        }
+        w->ops += 2 * BENCH_BATCH;
+        cond_resched();
+    }
+
+    complete(&w->done);
+    return 0;
+}
+
+/**
+ * run `threads` threads allocating and releasing memory in parallel
+ */
+static void _run_mem_bench(int threads, int iterations)
+{
+    BenchWorker workers[MAX_BENCH_THREADS];
+    unsigned long hits, refills, flushes;
+    unsigned long hits_after, refills_after, flushes_after;
+    unsigned long ops = 0, failures = 0;
+    int started = 0;
+
+    mem_cache_stat(&hits, &refills, &flushes);
+    ktime_t start = ktime_get();
+
+    for (int i = 0; i < threads; i++) {
+        memset(&workers[i], 0, sizeof(BenchWorker));
+        workers[i].iterations = iterations;
+        init_completion(&workers[i].done);
+        struct task_struct * task = kthread_run(_mem_bench_worker, &workers[i], 
+                "asgn2_bench/%d", i);
+        if (IS_ERR(task)) {
+            E(TAG, "Unable to start benchmark thread: %ld", PTR_ERR(task));
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++) {
+        wait_for_completion(&workers[i].done);
+        ops += workers[i].ops;
+        failures += workers[i].failures;
+    }
+
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    mem_cache_stat(&hits_after, &refills_after, &flushes_after);
+
+    snprintf(result, RESULT_SIZE, "threads: %d\nops: %lu\nfailures: %lu\nns: %llu\n"
+            "ns_per_op: %llu\nops_per_sec: %llu\n"
+            "magazine_hits: %lu\nmagazine_refills: %lu\nmagazine_flushes: %lu\n", 
+            started, ops, failures, ns, ops ? div64_u64(ns, ops) : 0, 
+            ns ? div64_u64((u64) ops * NSEC_PER_SEC, ns) : 0, 
+            hits_after - hits, refills_after - refills, flushes_after - flushes);
+}
+
+static ssize_t mem_bench_write(struct file * filep, const char __user * buff, 
+        size_t size, loff_t * offset)
+{
+    char input[32];
+    int threads, iterations;
+
+    if (size >= sizeof(input)) return -EINVAL;
+    if (copy_from_user(input, buff, size)) return -EFAULT;
+    input[size] = '\0';
+
+    // format: <threads> <iterations>
+    if (2 != sscanf(input, "%d %d", &threads, &iterations) 
+            || threads < 1 || threads > MAX_BENCH_THREADS || iterations < 1) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&bench_lock);
+    I(TAG, "Start memory benchmark with %d threads, %d iterations", threads, iterations);
+    _run_mem_bench(threads, iterations);
+    mutex_unlock(&bench_lock);
+
+    return size;
+}
+
+static ssize_t bench_read(struct file * filep, char __user * buff, 
+        size_t size, loff_t * offset)
+{
+    mutex_lock(&bench_lock);
+    ssize_t ret = simple_read_from_buffer(buff, size, offset, result, strlen(result));
+    mutex_unlock(&bench_lock);
+    return ret;
+}
+
+/**
+ * simple pseudo random generator, so that every run replays the same trace
+ */
+static u32 _next_random(u32 * seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/**
+ * size of the next object in the trace, most of the allocations are small records 
+ * and page nodes, with some larger objects
+ */
+static int _trace_object_size(u32 rnd)
+{
+    int kind = rnd % 10;
+    if (kind < 6) return 24;
+    if (kind < 9) return 40;
+    return 100 + rnd % 900;
+}
+
+/**
+ * replay an alloc/free trace with `live` objects alive at most, 
+ * the first quarter of the objects lives much longer than the others
+ */
+static void _run_mem_trace(int live, int operations)
+{
+    void ** objects = kcalloc(live, sizeof(void *), GFP_KERNEL);
+    int * sizes = kcalloc(live, sizeof(int), GFP_KERNEL);
+    if (!objects || !sizes) {
+        snprintf(result, RESULT_SIZE, "unable to allocate memory for the trace\n");
+        goto release;
+    }
+
+    u32 seed = 440;
+    unsigned long live_bytes = 0, peak_live_bytes = 0, peak_pages = 0, failures = 0;
+
+    ktime_t start = ktime_get();
+    for (int i = 0; i < operations; i++) {
+        u32 rnd = _next_random(&seed);
+        int index = rnd % live;
+
+        if (objects[index]) {
+            // the long-lived objects are released less often
+            if (index < live / 4 && (rnd >> 16) % 8) continue;
+
+            release_mem(objects[index]);
+            objects[index] = NULL;
+            live_bytes -= sizes[index];
+        } else {
+            sizes[index] = _trace_object_size(_next_random(&seed));
+            objects[index] = alloc_mem(sizes[index]);
+            if (NULL == objects[index]) {
+                failures++;
+                continue;
+            }
+            live_bytes += sizes[index];
+        }
+
+        peak_live_bytes = MAX(peak_live_bytes, live_bytes);
+        peak_pages = MAX(peak_pages, mem_cache_pages());
+    }
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    for (int i = 0; i < live; i++) {
+        release_mem(objects[i]);
+    }
+
+    snprintf(result, RESULT_SIZE, "live: %d\nops: %d\nfailures: %lu\nns: %llu\n"
+            "ops_per_sec: %llu\npeak_live_bytes: %lu\npeak_pages: %lu\n"
+            "overhead(%%): %lu\n", 
+            live, operations, failures, ns, 
+            ns ? div64_u64((u64) operations * NSEC_PER_SEC, ns) : 0, 
+            peak_live_bytes, peak_pages, peak_live_bytes 
+                ? peak_pages * PAGE_SIZE * 100 / peak_live_bytes : 0);
+
+release:
+    kfree(objects);
+    kfree(sizes);
+}
+
+static ssize_t mem_trace_write(struct file * filep, const char __user * buff, 
+        size_t size, loff_t * offset)
+{
+    char input[32];
+    int live, operations;
+
+    if (size >= sizeof(input)) return -EINVAL;
+    if (copy_from_user(input, buff, size)) return -EFAULT;
+    input[size] = '\0';
+
+    // format: <live objects> <operations>
+    if (2 != sscanf(input, "%d %d", &live, &operations) || live < 1 || operations < 1) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&bench_lock);
+    I(TAG, "Start memory trace with %d live objects, %d operations", live, operations);
+    _run_mem_trace(live, operations);
+    mutex_unlock(&bench_lock);
+
+    return size;
+}
+
+/**
+ * push `messages` small messages through a delimiter buffer, 
+ * the messages are written in batches and then read back one by one
+ */
+static void _run_msg_bench(int messages)
+{
+    char payload[MSG_PAYLOAD_SIZE + 1] = "asgn2msg";
+    char out[MSG_PAYLOAD_SIZE];
+    unsigned long delivered = 0, failures = 0;
+
+    PDBuffer buff = create_new_dbuffer();
+    if (!buff) {
+        snprintf(result, RESULT_SIZE, "unable to create the delimiter buffer\n");
+        return;
+    }
+
+    ktime_t start = ktime_get();
+    for (int i = 0; i < messages; i += MSG_BATCH) {
+        int batch = MIN(MSG_BATCH, messages - i);
+
+        for (int j = 0; j < batch; j++) {
+            if (sizeof(payload) != write_into_dbuffer(buff, payload, sizeof(payload))) {
+                failures++;
+            }
+        }
+        for (int j = 0; j < batch; j++) {
+            if (MSG_PAYLOAD_SIZE == read_from_dbuffer(buff, out, sizeof(out)) 
+                    && SUCC == dbuffer_end_phase_reading(buff)) {
+                delivered++;
+            }
+        }
+        cond_resched();
+    }
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    release_dbuffer(buff);
+
+    snprintf(result, RESULT_SIZE, "messages: %d\npayload: %d\ndelivered: %lu\n"
+            "failures: %lu\nns: %llu\nns_per_msg: %llu\nmsgs_per_sec: %llu\n", 
+            messages, MSG_PAYLOAD_SIZE, delivered, failures, ns, 
+            delivered ? div64_u64(ns, delivered) : 0, 
+            ns ? div64_u64((u64) delivered * NSEC_PER_SEC, ns) : 0);
+}
+
+static ssize_t msg_bench_write(struct file * filep, const char __user * buff, 
+        size_t size, loff_t * offset)
+{
+    char input[32];
+    int messages;
+
+    if (size >= sizeof(input)) return -EINVAL;
+    if (copy_from_user(input, buff, size)) return -EFAULT;
+    input[size] = '\0';
+
+    // format: <messages>
+    if (1 != sscanf(input, "%d", &messages) || messages < 1) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&bench_lock);
+    I(TAG, "Start message benchmark with %d messages", messages);
+    _run_msg_bench(messages);
+    mutex_unlock(&bench_lock);
+
+    return size;
+}
+
+/**
+ * allocate each size around a page once, every allocation must succeed, 
+ * and no empty page may be left behind after they are all released
+ */
+static void _run_mem_boundary(void)
+{
+    unsigned long failures = 0;
+    int first_failure = 0;
+    unsigned long pages = mem_cache_pages();
+
+    for (int size = PAGE_SIZE - BOUNDARY_BELOW; size <= PAGE_SIZE + BOUNDARY_ABOVE; size++) {
+        char * mem = (char *) alloc_mem_flags(size, MEM_SLEEPABLE);
+        if (!mem) {
+            if (!failures) first_failure = size;
+            failures++;
+            continue;
+        }
+        // the whole memory must be usable
+        memset(mem, 0x5a, size);
+        release_mem(mem);
+    }
+
+    unsigned long pages_after = mem_cache_pages();
+    snprintf(result, RESULT_SIZE, "sizes: %d-%lu\nfailures: %lu\nfirst_failure: %d\n"
+            "leaked_pages: %ld\nresult: %s\n", 
+            (int) PAGE_SIZE - BOUNDARY_BELOW, PAGE_SIZE + BOUNDARY_ABOVE, failures, 
+            first_failure, (long) (pages_after - pages), 
+            0 == failures && pages_after == pages ? "pass" : "fail");
+}
+
+static ssize_t mem_boundary_write(struct file * filep, const char __user * buff, 
+        size_t size, loff_t * offset)
+{
+    mutex_lock(&bench_lock);
+    I(TAG, "Start the boundary test of the memory cache");
+    _run_mem_boundary();
+    mutex_unlock(&bench_lock);
+
+    return size;
+}
+
+static const struct file_operations mem_boundary_fops = {
+    .owner = THIS_MODULE,
+    .read = bench_read,
+    .write = mem_boundary_write,
+};
+
+static const struct file_operations msg_bench_fops = {
+    .owner = THIS_MODULE,
+    .read = bench_read,
+    .write = msg_bench_write,
+};
+
+static const struct file_operations mem_trace_fops = {
+    .owner = THIS_MODULE,
+    .read = bench_read,
+    .write = mem_trace_write,
+};
+
+static const struct file_operations mem_bench_fops = {
+    .owner = THIS_MODULE,
+    .read = bench_read,
+    .write = mem_bench_write,
+};
+
+int init_bench(struct dentry * dir)
+{
+    debugfs_create_file("mem_bench", 0600, dir, NULL, &mem_bench_fops);
+    debugfs_create_file("mem_trace", 0600, dir, NULL, &mem_trace_fops);
+    debugfs_create_file("msg_bench", 0600, dir, NULL, &msg_bench_fops);
+    debugfs_create_file("mem_boundary", 0600, dir, NULL, &mem_boundary_fops);
+    return SUCC;
+}
@@ -32,7 +32,9 @@ inline _PCBuffer _convert_cbuffer (PCBuffer buff)
 PCBuffer create_new_cbuffer (size_t size) 
 {
     size_t allocated_size = size + EXTRA_SIZE;
-    _PCBuffer buff = (_PCBuffer) alloc_mem(allocated_size);
+    // the buffer is created in process context, 
+    // so it may be as large as the virtually contiguous memory allows
+    _PCBuffer buff = (_PCBuffer) alloc_mem_flags(allocated_size, MEM_SLEEPABLE);
     if (NULL == buff) {
         E(TAG, "Unable to allocate memory for CBuffer");
         return NULL;
@@ -48,9 +50,11 @@ PCBuffer init_new_cbuffer(void * p, size_t mem_size)
         W(TAG, "No enough memory to create CBuffer");
         return NULL;
     }
-    memset(p, 0, mem_size);
+    // only the header needs to be initialised, the data is always written before read
     _PCBuffer buff = (_PCBuffer) p;
     buff->total_size = size;
+    buff->r_pos = 0;
+    buff->w_pos = 0;
     return &buff->inner;
 }
 
@@ -145,3 +149,44 @@ size_t read_from_cbuffer(PCBuffer cbuff, char * buff, size_t size)
     D(TAG, "Successfully read %d bytes data from the buffer", already_read_size);
     return already_read_size;
 }
+
+/**
+ * expose the data in the buffer without copying it out
+ * @return: how many bytes of data the segments contain, 
+ *          unused segments are set to zero size
+ * the segments stay valid until the data is consumed by `cbuffer_consume`, 
+ * as the writer only appends data behind them
+ */
+size_t cbuffer_get_segments(PCBuffer cbuff, CBufferSegment segs[CBUFFER_MAX_SEGMENTS])
+{
+    CONVERT(pb, cbuff);
+
+    size_t buffer_size = _buff_size(pb);
+    size_t first_size = MIN(buffer_size, pb->total_size - R_POS(pb));
+
+    segs[0].buff = pb->buffer + R_POS(pb);
+    segs[0].size = first_size;
+    // the rest of the data wraps around to the beginning of the buffer
+    segs[1].buff = pb->buffer;
+    segs[1].size = buffer_size - first_size;
+
+    D(TAG, "Exposed %d bytes data in segments: %d, %d", buffer_size, 
+            segs[0].size, segs[1].size);
+    return buffer_size;
+}
+
+/**
+ * drop the data from the beginning of the buffer, 
+ * used after the data exposed by `cbuffer_get_segments` has been handled
+ */
+size_t cbuffer_consume(PCBuffer cbuff, size_t size)
+{
+    CONVERT(pb, cbuff);
+
+    size_t consume_size = MIN(size, _buff_size(pb));
+    pb->r_pos += consume_size;
+
+    _adjust_pos(pb);
+    D(TAG, "Successfully consumed %d bytes data from the buffer", consume_size);
+    return consume_size;
+}
@@ -2,6 +2,9 @@
 # include <linux/types.h>
 # include <linux/string.h>
 # include <linux/spinlock.h>
+# include <linux/rcupdate.h>
+# include <linux/crc32.h>
+# include <linux/workqueue.h>
 
 # include "common.h"
 # include "mem_cache.h"
@@ -12,24 +15,78 @@
 
 # define CONVERT(p, b) _PDBuffer p = _convert((b))
 
-typedef struct {
-    unsigned short has_delimiter;
-    size_t buffer_size;
+static const char DELIMITER = '\0';
+
+// the delimiter of the record has been recognised
+# define RECORD_HAS_DELIMITER 0x1
+// some data of the record has been lost
+# define RECORD_CORRUPT 0x2
+
+// the initial value of the CRC32 of each record, the CRC is inverted when reported
+# define RECORD_CRC_SEED (~0U)
+
+// must be a power of 2, the ring is doubled when it is full
+# define INITIAL_RECORD_CAPACITY 64
+// the ring is doubled in process context in advance once it is 3/4 full, 
+// and halved when only 1/8 of it is used
+# define RING_GROW_THRESHOLD(c) ((c) / 4 * 3)
+# define RING_SHRINK_THRESHOLD(c) ((c) / 8)
 
-    ListHead node;
+# define RECORD_AT(r, i) (&(r)->entries[((r)->head + (i)) & ((r)->capacity - 1)])
+# define FIRST_RECORD(r) RECORD_AT((r), 0)
+# define LAST_RECORD(r) RECORD_AT((r), (r)->count - 1)
+
+// the ring of the buffer, which can only be changed with the lock held
+# define RING(b) rcu_dereference_protected((b)->ring, lockdep_is_held(&(b)->lock))
+
+typedef struct {
+    // absolute stream offset of the first unread byte of the record
+    u64 offset;
+    // size of the unread data of the record, the delimiter is not included
+    size_t length;
+    // size of all the data of the record and its CRC32, updated while it is written
+    size_t size;
+    u32 crc;
+    unsigned int flags;
 } DRecord;
 
 typedef DRecord * PDRecord;
 
+// the boundaries of the messages, there should be at least one record in the ring.
+// the readers peek at the first record without the lock, so the ring is replaced 
+// and released after a grace period when it grows
+typedef struct {
+    struct rcu_head rcu;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    DRecord entries[];
+} RecordRing;
+
+typedef RecordRing * PRecordRing;
+
 
 typedef struct {
     DelimiterBuffer inner;
     PPBuffer page_buffer;
 
-    // there should be at least one record in this list
-    ListHead records;
+    PRecordRing __rcu ring;
 
+    // absolute stream offset after the last written byte
+    u64 write_offset;
+
+    // size of the data reserved for reading, which cannot be consumed by others
+    size_t reserved_size;
+
+    // taken by the tasklet and the reader, always with the bottom halves disabled
     spinlock_t lock;
+
+    // resizes the ring with the memory allocated outside the lock, which may sleep
+    struct work_struct resize_work;
+
+    // releases the consumed data out of the retention window while the stream is idle, 
+    // only scheduled while some chunk is waiting for the time limit of the window
+    struct delayed_work reclaim_work;
 } _DBuffer;
 
 typedef _DBuffer * _PDBuffer;
@@ -40,30 +97,68 @@ inline _PDBuffer _convert(PDBuffer b)
     return (_PDBuffer) ((char *) b - offsetof(_DBuffer, inner));
 }
 
+/**
+ * the window is also checked when the data is consumed or written, 
+ * but nothing happens to an idle stream, so its chunks would be kept forever
+ */
+static void _reclaim_work_fn(struct work_struct * work)
+{
+    _PDBuffer pb = container_of(to_delayed_work(work), _DBuffer, reclaim_work);
+
+    softirq_lock(&pb->lock);
+    unsigned long delay = pbuffer_reclaim(pb->page_buffer);
+    softirq_unlock(&pb->lock);
+
+    // stops once nothing is waiting, it is armed again when the data is consumed
+    if (delay) schedule_delayed_work(&pb->reclaim_work, delay);
+}
+
+/**
+ * arm the reclaim work after the data is consumed or the buffer is unpinned, 
+ * it is kept if it has been armed, which is for an older chunk, 
+ * must be called with the lock held
+ */
+static void _arm_reclaim_locked(_PDBuffer pb)
+{
+    lockdep_assert_held(&pb->lock);
+    unsigned long delay = pbuffer_reclaim_delay(pb->page_buffer);
+    if (delay) schedule_delayed_work(&pb->reclaim_work, delay);
+}
+
+static void _resize_work_fn(struct work_struct * work);
+
 PDBuffer create_new_dbuffer(void)
 {
-    _PDBuffer p = (_PDBuffer) alloc_mem(sizeof(_DBuffer));
+    _PDBuffer p = (_PDBuffer) alloc_mem_flags(sizeof(_DBuffer), MEM_ZERO);
     if (!p) {
         return NULL;
     }
 
+    spin_lock_init(&p->lock);
+    lock_stat_register(&p->lock, "dbuffer_lock");
+
     p->page_buffer = create_new_pbuffer(); 
     if (!p->page_buffer) goto error_with_pdbuffer;
 
-    INIT_LIST_HEAD(&p->records);
+    PRecordRing ring = (PRecordRing) alloc_mem_flags(sizeof(RecordRing) 
+            + INITIAL_RECORD_CAPACITY * sizeof(DRecord), MEM_ZERO);
+    if (!ring) goto error_with_page_buffer;
 
-    PDRecord record = (PDRecord) alloc_mem(sizeof(DRecord));
-    if (!record) goto error_with_page_buffer;
-    memset(record, 0, sizeof(DRecord));
+    // at least add a record to the ring
+    ring->capacity = INITIAL_RECORD_CAPACITY;
+    ring->count = 1;
+    ring->entries[0].crc = RECORD_CRC_SEED;
+    RCU_INIT_POINTER(p->ring, ring);
 
-    // at least add a record to the list
-    list_add_tail(&record->node, &p->records);
+    INIT_WORK(&p->resize_work, _resize_work_fn);
+    INIT_DELAYED_WORK(&p->reclaim_work, _reclaim_work_fn);
     return &p->inner;
 
 error_with_page_buffer:
     release_pbuffer(p->page_buffer);
 
 error_with_pdbuffer:
+    lock_stat_unregister(&p->lock);
     release_mem(p);
     return NULL;
 }
@@ -74,88 +169,271 @@ void release_dbuffer(PDBuffer buff)
 
     CONVERT(pb, buff);
     
-    while (!list_empty(&pb->records)) {
-        PDRecord first = list_first_entry_or_null(&pb->records, DRecord, node);
-        if (first) {
-            list_del(&first->node);
-            release_mem(first);
-        }
-    }
+    // the work may reschedule itself, the cancellation waits for it and stops that
+    cancel_delayed_work_sync(&pb->reclaim_work);
+    cancel_work_sync(&pb->resize_work);
+
+    // nobody is able to peek at it any more, the old rings are waited by `release_pbuffer`
+    release_mem(rcu_dereference_protected(pb->ring, 1));
 
     release_pbuffer(pb->page_buffer);
 
+    lock_stat_unregister(&pb->lock);
     release_mem(pb);
 }
 
-size_t write_into_dbuffer(PDBuffer b, void * buff, size_t size)
+void _release_ring_rcu(struct rcu_head * head)
 {
-    CONVERT(pb, b);
+    release_mem(container_of(head, RecordRing, rcu));
+}
+
+/**
+ * move the records to the beginning of the new `ring` of `capacity` and replace the old one
+ * must be called with the lock held
+ */
+void _replace_ring_locked(_PDBuffer pb, PRecordRing ring, size_t capacity)
+{
+    lockdep_assert_held(&pb->lock);
+    PRecordRing old = RING(pb);
 
-    const char delimiter = '\0';
+    for (size_t i = 0; i < old->count; i++) {
+        ring->entries[i] = *RECORD_AT(old, i);
+    }
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->count = old->count;
 
-    spin_lock_wrapper(&pb->lock);
+    rcu_assign_pointer(pb->ring, ring);
+    // the readers may still be peeking at the old one
+    call_rcu(&old->rcu, _release_ring_rcu);
+}
 
-    PDRecord last_record = list_last_entry(&pb->records, DRecord, node);
-    size_t write_size = write_into_pbuffer(pb->page_buffer, buff, size);
-    D(TAG, "Successfully write %d bytes data into dbuffer from %lu", 
-            write_size, P2L(buff));
-
-    if (write_size > 0) {
-        // detect all demiliters and generate corresponding delimiter records
-        // update the buffer size before the delimiter
-        void * check_buff = buff;
-        int index = simple_char_index(check_buff, write_size, (void *) &delimiter);
-        if (index >= 0) {
-            while (index >= 0) {
-                D(TAG, "Found delimiter in the buffer, position is: %d", index);
-                D(TAG, "String before delimiter: %s", (char *)check_buff);
-
-                last_record->buffer_size += index;
-                last_record->has_delimiter = 1;
-    
-                // generate a new record and append it to the list
-                last_record = alloc_mem(sizeof(DRecord));
-                if (NULL == last_record) {
-                    break;
-                }
-                memset(last_record, 0, sizeof(DRecord));
-                list_add_tail(&last_record->node, &pb->records);
-
-                check_buff += index + 1;
-                if (check_buff >= buff + write_size) {
-                    break;
-                }
-                // make sure all delimiters in the buffer have been recorded
-                index = simple_char_index(check_buff, buff + write_size - check_buff, 
-                        (void *) &delimiter);
-            }
-        } else {
-            last_record->buffer_size += write_size;
+/**
+ * @return: the capacity the ring should be resized to, or its current capacity
+ */
+size_t _wanted_capacity(PRecordRing ring)
+{
+    if (ring->count >= RING_GROW_THRESHOLD(ring->capacity)) return ring->capacity * 2;
+    if (ring->capacity > INITIAL_RECORD_CAPACITY 
+            && ring->count <= RING_SHRINK_THRESHOLD(ring->capacity)) {
+        return ring->capacity / 2;
+    }
+    return ring->capacity;
+}
+
+/**
+ * schedule the resizing in process context if the ring needs it, 
+ * must be called with the lock held
+ */
+void _check_ring_locked(_PDBuffer pb)
+{
+    PRecordRing ring = RING(pb);
+    if (_wanted_capacity(ring) != ring->capacity) schedule_work(&pb->resize_work);
+}
+
+static void _resize_work_fn(struct work_struct * work)
+{
+    _PDBuffer pb = container_of(work, _DBuffer, resize_work);
+
+    while (1) {
+        softirq_lock(&pb->lock);
+        size_t capacity = _wanted_capacity(RING(pb));
+        int resize = capacity != RING(pb)->capacity;
+        softirq_unlock(&pb->lock);
+        if (!resize) return;
+
+        // the large rings fall back to vmalloc, which isn't possible under the lock
+        PRecordRing ring = (PRecordRing) alloc_mem_flags(sizeof(RecordRing) 
+                + capacity * sizeof(DRecord), MEM_SLEEPABLE);
+        if (NULL == ring) {
+            E(TAG, "Unable to allocate memory for %d records", capacity);
+            return;
+        }
+
+        softirq_lock(&pb->lock);
+        // the records may have changed while allocating, try again if so
+        if (_wanted_capacity(RING(pb)) == capacity) {
+            D(TAG, "Resize the ring from %d to %d records", RING(pb)->capacity, capacity);
+            _replace_ring_locked(pb, ring, capacity);
+            ring = NULL;
+        }
+        softirq_unlock(&pb->lock);
+
+        if (NULL == ring) return;
+        release_mem(ring);
+    }
+}
+
+/**
+ * double the capacity of the ring at once when it is full before the work has grown it, 
+ * must be called with the lock held
+ */
+int _grow_records_locked(_PDBuffer pb)
+{
+    lockdep_assert_held(&pb->lock);
+    size_t capacity = RING(pb)->capacity * 2;
+    PRecordRing ring = (PRecordRing) alloc_mem(sizeof(RecordRing) 
+            + capacity * sizeof(DRecord));
+    if (NULL == ring) {
+        E(TAG, "Unable to allocate memory for %d records", capacity);
+        return FAIL;
+    }
+
+    _replace_ring_locked(pb, ring, capacity);
+    return SUCC;
+}
+
+/**
+ * write the data into the page buffer piece by piece, each piece ends with a delimiter
+ * or the end of the data, so the delimiters are detected in the same pass as copying
+ * must be called with the lock held
+ */
+size_t _write_into_dbuffer_locked(_PDBuffer pb, char * buff, size_t size)
+{
+    lockdep_assert_held(&pb->lock);
+    size_t already_write_size = 0;
+    PRecordRing ring = RING(pb);
+    PDRecord last_record = LAST_RECORD(ring);
+
+    while (already_write_size < size) {
+        char * start = buff + already_write_size;
+        size_t left_size = size - already_write_size;
+        char * delimiter = memchr(start, DELIMITER, left_size);
+        size_t piece_size = delimiter ? delimiter - start + 1 : left_size;
+
+        if (delimiter && ring->count == ring->capacity) {
+            // make room for the record behind the delimiter in advance,
+            // if there is no memory for it, leave the rest of data to the caller
+            if (SUCC != _grow_records_locked(pb)) break;
+            ring = RING(pb);
+            last_record = LAST_RECORD(ring);
+        }
+
+        size_t write_size = write_into_pbuffer(pb->page_buffer, start, piece_size);
+        already_write_size += write_size;
+        pb->write_offset += write_size;
+        if (write_size < piece_size || !delimiter) {
+            // the delimiter hasn't been written into the buffer
+            last_record->size += write_size;
+            last_record->crc = crc32_le(last_record->crc, (unsigned char *) start, write_size);
+            WRITE_ONCE(last_record->length, last_record->length + write_size);
+            if (write_size < piece_size) break;
+            continue;
         }
+
+        D(TAG, "Found delimiter in the buffer, position is: %d", piece_size - 1);
+        // the delimiter itself doesn't belong to the record
+        last_record->size += write_size - 1;
+        last_record->crc = crc32_le(last_record->crc, (unsigned char *) start, write_size - 1);
+        last_record->length += write_size - 1;
+        // the lockless readers see the final length once they see the flag
+        smp_store_release(&last_record->flags, last_record->flags | RECORD_HAS_DELIMITER);
+
+        PDRecord new_record = RECORD_AT(ring, ring->count);
+        new_record->offset = pb->write_offset;
+        new_record->length = 0;
+        new_record->size = 0;
+        new_record->crc = RECORD_CRC_SEED;
+        new_record->flags = 0;
+        WRITE_ONCE(ring->count, ring->count + 1);
+        last_record = new_record;
     }
-    spin_unlock_wrapper(&pb->lock);
+    // grow the ring in advance, so it is rarely grown here without sleeping
+    _check_ring_locked(pb);
+
+    D(TAG, "Successfully write %d bytes data into dbuffer from %lu", 
+            already_write_size, P2L(buff));
+    return already_write_size;
+}
+
+size_t write_into_dbuffer(PDBuffer b, void * buff, size_t size)
+{
+    CONVERT(pb, b);
+
+    softirq_lock(&pb->lock);
+    size_t write_size = _write_into_dbuffer_locked(pb, buff, size);
+    softirq_unlock(&pb->lock);
     return write_size;
 }
 
-size_t _read_from_dbuffer_generic(PDBuffer pb, void * buff, size_t size, int to_user)
+/**
+ * migrate the data exposed by the circular buffer directly into the page buffer, 
+ * the segments are written in order, stops at the first segment which cannot be 
+ * written completely
+ */
+size_t write_segments_into_dbuffer(PDBuffer b, CBufferSegment segs[CBUFFER_MAX_SEGMENTS])
+{
+    CONVERT(pb, b);
+
+    size_t total_size = 0;
+
+    softirq_lock(&pb->lock);
+    for (int i = 0; i < CBUFFER_MAX_SEGMENTS; i++) {
+        if (0 == segs[i].size) continue;
+
+        size_t write_size = _write_into_dbuffer_locked(pb, segs[i].buff, segs[i].size);
+        total_size += write_size;
+        if (write_size < segs[i].size) break;
+    }
+    softirq_unlock(&pb->lock);
+
+    return total_size;
+}
+
+/**
+ * reserve the data at the beginning of the current record for reading,
+ * the reserved data won't be changed until it is committed
+ * @return: size of the reserved data, 0 means nothing to read or already reserved
+ */
+size_t dbuffer_reserve_read(PDBuffer pb, size_t size)
 {
     CONVERT(b, pb);
-    spin_lock_wrapper(&b->lock);
 
-    size_t read_size = 0;
-    PDRecord record = list_first_entry(&b->records, DRecord, node);
-    if (record->buffer_size > 0) {
-        // make sure the part exceeds the delimiter is not read
-        size = MIN(record->buffer_size, size);
+    size_t reserved_size = 0;
 
-        read_size = to_user ? read_from_pbuffer_into_user(b->page_buffer, buff, size) 
-            : read_from_pbuffer(b->page_buffer, buff, size);
-        if (read_size >= 0) {
-            record->buffer_size -= read_size;
-        }
+    softirq_lock(&b->lock);
+    PDRecord record = FIRST_RECORD(RING(b));
+    if (0 == b->reserved_size) {
+        // make sure the part exceeds the delimiter is not read
+        reserved_size = MIN(record->length, size);
+        b->reserved_size = reserved_size;
     }
+    softirq_unlock(&b->lock);
 
-    spin_unlock_wrapper(&b->lock);
+    return reserved_size;
+}
+
+/**
+ * consume the data which has been read from the reservation, and end the reservation
+ */
+void dbuffer_commit_read(PDBuffer pb, size_t size)
+{
+    CONVERT(b, pb);
+
+    softirq_lock(&b->lock);
+    PDRecord record = FIRST_RECORD(RING(b));
+    size = MIN(size, b->reserved_size);
+    size = discard_from_pbuffer(b->page_buffer, size);
+    WRITE_ONCE(record->length, record->length - size);
+    record->offset += size;
+    b->reserved_size = 0;
+    _arm_reclaim_locked(b);
+    softirq_unlock(&b->lock);
+}
+
+size_t _read_from_dbuffer_generic(PDBuffer pb, void * buff, size_t size, int to_user)
+{
+    CONVERT(b, pb);
+
+    size = dbuffer_reserve_read(pb, size);
+    if (0 == size) return 0;
+
+    // copy without holding the lock, as copying to user space may sleep, 
+    // and the writer is able to keep appending data at the same time
+    size_t read_size = to_user ? get_from_pbuffer_into_user(b->page_buffer, buff, size) 
+        : get_from_pbuffer(b->page_buffer, buff, size);
+
+    dbuffer_commit_read(pb, read_size);
     return read_size;
 }
 
@@ -169,60 +447,252 @@ size_t read_from_dbuffer_to_user(PDBuffer pb, void __user * buff, size_t size)
     return _read_from_dbuffer_generic(pb, buff, size, 1);
 }
 
+u64 dbuffer_offset(PDBuffer pb)
+{
+    CONVERT(b, pb);
+
+    return pbuffer_offset(b->page_buffer);
+}
+
+void dbuffer_window(PDBuffer pb, u64 * start, u64 * end)
+{
+    CONVERT(b, pb);
+
+    softirq_lock(&b->lock);
+    pbuffer_window(b->page_buffer, start, end);
+    softirq_unlock(&b->lock);
+}
+
+ssize_t dbuffer_read_at(PDBuffer pb, u64 offset, void __user * buff, size_t size)
+{
+    CONVERT(b, pb);
+    u64 start, end;
+
+    softirq_lock(&b->lock);
+    pbuffer_window(b->page_buffer, &start, &end);
+    // keep the data in the window until it is copied
+    if (offset >= start) pbuffer_pin(b->page_buffer);
+    softirq_unlock(&b->lock);
+
+    if (offset < start) return -ENODATA;
+
+    // copy without holding the lock, as copying to user space may sleep
+    size_t read_size = 0;
+    if (offset < end) {
+        read_size = get_from_pbuffer_at_offset_into_user(b->page_buffer, offset, 
+                buff, MIN(size, (size_t) (end - offset)));
+    }
+
+    softirq_lock(&b->lock);
+    if (0 == read_size && size > 0 && offset < end) {
+        // nothing copied, either the data has been released or the user buffer is bad
+        pbuffer_window(b->page_buffer, &start, &end);
+        read_size = offset < start ? -ENODATA : -EFAULT;
+    }
+    pbuffer_unpin(b->page_buffer);
+    _arm_reclaim_locked(b);
+    softirq_unlock(&b->lock);
+    return read_size;
+}
+
+/**
+ * take a snapshot of the first record without the lock, 
+ * the writer only appends to it, and only the reader itself removes it
+ * @return: 1 means the delimiter of the record has been recognised, otherwise 0
+ */
+int _peek_first_record(_PDBuffer pb, size_t * length)
+{
+    rcu_read_lock();
+    PRecordRing ring = rcu_dereference(pb->ring);
+    PDRecord record = &ring->entries[READ_ONCE(ring->head) & (ring->capacity - 1)];
+    // pairs with the release in `_write_into_dbuffer_locked`
+    int completed = (smp_load_acquire(&record->flags) & RECORD_HAS_DELIMITER) ? 1 : 0;
+    *length = READ_ONCE(record->length);
+    rcu_read_unlock();
+
+    return completed;
+}
+
 /**
  * check if the dbuffer contains data to read
  * @return: -1 means no more data to read; 
  *          0 means need to wait; 
  *          positive value means how many bytes of data in the buffer
  */
+size_t dbuffer_size(PDBuffer pb)
+{
+    CONVERT(buff, pb);
+
+    return pbuffer_size(buff->page_buffer);
+}
+
 int dbuffer_contains_data(PDBuffer pb)
 {
     CONVERT(buff, pb);
 
+    size_t length;
     int result = 0;
 
-    spin_lock_wrapper(&buff->lock);
-
-    PDRecord record = list_first_entry(&buff->records, DRecord, node);
-    if (record->has_delimiter) {
+    if (_peek_first_record(buff, &length)) {
         // has recognised the delimiter, only the data in the buffer can be read
-        result = record->buffer_size ? record->buffer_size : -1;
+        result = length ? length : -1;
     } else {
         // hasn't recognised the delimiter yet, 
         // probably there is some data event though no data in buffer
-        result = record->buffer_size;
+        result = length;
     }
 
-    spin_unlock_wrapper(&buff->lock);
-
     return result;
 }
 
-void dbuffer_end_phase_reading(PDBuffer buff)
+/**
+ * check if the delimiter of the data being read has been recognised
+ * @return: 1 means the data before the delimiter is complete, otherwise 0
+ */
+int dbuffer_record_completed(PDBuffer pb)
+{
+    CONVERT(buff, pb);
+
+    size_t length;
+    return _peek_first_record(buff, &length) ? 1 : 0;
+}
+
+void dbuffer_record_info(PDBuffer buff, PDBufferRecordInfo info)
+{
+    CONVERT(pb, buff);
+
+    softirq_lock(&pb->lock);
+    PDRecord record = FIRST_RECORD(RING(pb));
+    info->size = record->size;
+    info->crc = record->crc ^ RECORD_CRC_SEED;
+    info->flags = 0;
+    if (record->flags & RECORD_HAS_DELIMITER) info->flags |= DBUFFER_RECORD_COMPLETED;
+    if (record->flags & RECORD_CORRUPT) info->flags |= DBUFFER_RECORD_CORRUPT;
+    softirq_unlock(&pb->lock);
+}
+
+/**
+ * the record holding the byte at `offset` is the last one which starts before it, 
+ * or the first one if the byte has been read already
+ */
+void dbuffer_mark_corrupt(PDBuffer buff, u64 offset)
+{
+    CONVERT(pb, buff);
+
+    softirq_lock(&pb->lock);
+    PRecordRing ring = RING(pb);
+    size_t i = ring->count - 1;
+    while (i > 0 && RECORD_AT(ring, i)->offset > offset) i--;
+    RECORD_AT(ring, i)->flags |= RECORD_CORRUPT;
+    softirq_unlock(&pb->lock);
+}
+
+/**
+ * move to the data behind the delimiter if all the data before it has been read
+ * @return: SUCC means moved to the next record, FAIL means nothing changed
+ */
+int dbuffer_end_phase_reading(PDBuffer buff)
 {
     CONVERT(pb, buff);
 
-    spin_lock_wrapper(&pb->lock);
+    int result = FAIL;
 
-    // only function to remove the records from the list (except the release function)
-    PDRecord record = list_first_entry(&pb->records,  DRecord, node);
-    if (record->has_delimiter && 0 == record->buffer_size) {
+    softirq_lock(&pb->lock);
+
+    // only function to remove the records from the ring
+    PRecordRing ring = RING(pb);
+    PDRecord record = FIRST_RECORD(ring);
+    if ((record->flags & RECORD_HAS_DELIMITER) && 0 == record->length 
+            && 0 == pb->reserved_size) {
         // all the data before the delimiter has been read,
-        // remove the delimiter and current record
-        list_del(&record->node);
-        if (list_empty(&pb->records)) {
-            // no more records in the list, reuse the old one, 
-            // make sure that at least one record is in the list
-            memset(record, 0, sizeof(DRecord));
-            list_add_tail(&record->node, &pb->records);
-        }
+        // remove the delimiter and current record, there is always a record 
+        // behind the one with the delimiter, so the ring never becomes empty
+        WRITE_ONCE(ring->head, (ring->head + 1) & (ring->capacity - 1));
+        ring->count--;
+        _check_ring_locked(pb);
         // read the delimiter out from the buffer
         char tmp;
         read_from_pbuffer(pb->page_buffer, &tmp, sizeof(char));
+        _arm_reclaim_locked(pb);
+        result = SUCC;
     } else {
         // hasn't recognised the delimiter or there is still some data in the buffer
         // do nothing, keep the data and record for next turn of reading
     }
 
-    spin_unlock_wrapper(&pb->lock);
+    softirq_unlock(&pb->lock);
+    return result;
+}
+
+size_t dbuffer_discard(PDBuffer buff, size_t size, size_t * messages)
+{
+    CONVERT(pb, buff);
+
+    size_t total = 0;
+    size_t records = 0;
+    size_t partial = 0;
+
+    softirq_lock(&pb->lock);
+    if (pb->reserved_size) goto unlock;
+
+    // find out how far to drop first, and then drop the data in one go
+    PRecordRing ring = RING(pb);
+    while (records < *messages && total < size) {
+        PDRecord record = RECORD_AT(ring, records);
+        size_t left = size - total;
+        if (left <= record->length || !(record->flags & RECORD_HAS_DELIMITER)) {
+            // the data of the record is dropped partially, 
+            // or its delimiter hasn't been recognised
+            partial = MIN(left, record->length);
+            break;
+        }
+        // the data and the delimiter of the record
+        total += record->length + 1;
+        records++;
+    }
+    total += partial;
+
+    total = discard_from_pbuffer(pb->page_buffer, total);
+    if (records > 0) {
+        // there is always a record behind the one with the delimiter
+        WRITE_ONCE(ring->head, (ring->head + records) & (ring->capacity - 1));
+        ring->count -= records;
+        _check_ring_locked(pb);
+    }
+    PDRecord first = FIRST_RECORD(ring);
+    WRITE_ONCE(first->length, first->length - partial);
+    first->offset += partial;
+    _arm_reclaim_locked(pb);
+
+unlock:
+    softirq_unlock(&pb->lock);
+    *messages = records;
+    return total;
+}
+
+/**
+ * start to walk the unread data of the current record in place, 
+ * the data won't be released until `dbuffer_end_iter` even if it is consumed
+ * @return: size of the data to walk
+ */
+size_t dbuffer_iter_record(PDBuffer buff, PPBufferIter it)
+{
+    CONVERT(pb, buff);
+
+    softirq_lock(&pb->lock);
+    size_t size = FIRST_RECORD(RING(pb))->length;
+    init_pbuffer_iter(pb->page_buffer, it, 0, size);
+    softirq_unlock(&pb->lock);
+
+    return size;
+}
+
+void dbuffer_end_iter(PDBuffer buff, PPBufferIter it)
+{
+    CONVERT(pb, buff);
+
+    softirq_lock(&pb->lock);
+    release_pbuffer_iter(it);
+    _arm_reclaim_locked(pb);
+    softirq_unlock(&pb->lock);
 }
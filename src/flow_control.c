@@ -0,0 +1,199 @@
+# include <linux/kernel.h>
+# include <linux/types.h>
+# include <linux/spinlock.h>
+# include <linux/ktime.h>
+# include <linux/debugfs.h>
+# include <linux/seq_file.h>
+
+# include "common.h"
+# include "mem_cache.h"
+# include "gpio_reader.h"
+# include "flow_control.h"
+
+# define TAG "FlowControl"
+
+# define CONVERT(p, f) _PFlowControl p = _convert((f))
+
+// the levels of the line
+# define LINE_RESUME 1
+# define LINE_PAUSE 0
+
+typedef struct _FlowControl _FlowControl;
+
+typedef _FlowControl * _PFlowControl;
+
+// drives the line in the GPIO device or in the fake register
+typedef struct {
+    const char * name;
+    void (*write_line)(_PFlowControl fc, int line, int value);
+} FlowBackend;
+
+struct _FlowControl {
+    FlowControl inner;
+
+    const FlowBackend * backend;
+    PGPIOReader reader;
+    // the level register of the fake backend, a bit for each GPIO
+    u32 fake_level;
+
+    int line;
+    size_t high;
+    size_t low;
+    // reads the size of the buffered data, without any lock
+    size_t (*buffered_size)(void *);
+    void * args;
+
+    // taken by the tasklet and the readers, always with the bottom halves disabled
+    spinlock_t lock;
+    int paused;
+    // when the current pause started
+    ktime_t paused_at;
+
+    // statistics of the pauses, protected by `lock`
+    unsigned long pauses;
+    s64 total_pause_us;
+    s64 max_pause_us;
+};
+
+inline _PFlowControl _convert(PFlowControl f)
+{
+    return (_PFlowControl) ((char *) f - offsetof(_FlowControl, inner));
+}
+
+static void _write_gpio_line(_PFlowControl fc, int line, int value)
+{
+    write_line_of_reader(fc->reader, line, value);
+}
+
+// acts like the set and clear registers of the GPIO device
+static void _write_fake_line(_PFlowControl fc, int line, int value)
+{
+    if (value) fc->fake_level |= 1 << line;
+    else fc->fake_level &= ~(1 << line);
+}
+
+static const FlowBackend gpio_backend = { "gpio", _write_gpio_line };
+static const FlowBackend fake_backend = { "fake", _write_fake_line };
+
+PFlowControl create_flow_control(PGPIOReader reader, int line, size_t high, size_t low, 
+        size_t (*buffered_size)(void *), void * args)
+{
+    if (!is_output_line_of_reader(line)) {
+        E(TAG, "GPIO%d isn't an output line of the device", line);
+        return NULL;
+    }
+    if (0 == high || low >= high) {
+        E(TAG, "Invalid watermarks, high: %d, low: %d", high, low);
+        return NULL;
+    }
+
+    _PFlowControl fc = (_PFlowControl) alloc_mem_flags(sizeof(_FlowControl),
+            MEM_ZERO | MEM_SLEEPABLE);
+    if (!fc) return NULL;
+
+    fc->backend = reader ? &gpio_backend : &fake_backend;
+    fc->reader = reader;
+    fc->line = line;
+    fc->high = high;
+    fc->low = low;
+    fc->buffered_size = buffered_size;
+    fc->args = args;
+    spin_lock_init(&fc->lock);
+    lock_stat_register(&fc->lock, "flow_control_lock");
+
+    // the sender is allowed to send at the beginning
+    fc->backend->write_line(fc, line, LINE_RESUME);
+    I(TAG, "Flow control on GPIO%d (%s), high: %d, low: %d",
+            line, fc->backend->name, high, low);
+    return &fc->inner;
+}
+
+/**
+ * must be called with the lock held
+ */
+static void _resume(_PFlowControl fc)
+{
+    s64 duration = ktime_us_delta(ktime_get(), fc->paused_at);
+    fc->backend->write_line(fc, fc->line, LINE_RESUME);
+    WRITE_ONCE(fc->paused, 0);
+    fc->total_pause_us += duration;
+    fc->max_pause_us = MAX(fc->max_pause_us, duration);
+    D(TAG, "Resumed the sender after %lld us", duration);
+}
+
+void update_flow_control(PFlowControl f)
+{
+    if (!f) return;
+    CONVERT(fc, f);
+
+    // the size changed by the caller must be visible before the flag is read, 
+    // pairs with the barrier after the sender is paused
+    smp_mb();
+
+    // the state only changes when a watermark is crossed,
+    // so most of the updates return without the lock
+    int paused = READ_ONCE(fc->paused);
+    size_t buffered = fc->buffered_size(fc->args);
+    if ((!paused && buffered < fc->high) || (paused && buffered > fc->low)) return;
+
+    softirq_lock(&fc->lock);
+    // the size read above may be stale, the data may have been consumed meanwhile
+    buffered = fc->buffered_size(fc->args);
+    if (!fc->paused && buffered >= fc->high) {
+        fc->backend->write_line(fc, fc->line, LINE_PAUSE);
+        WRITE_ONCE(fc->paused, 1);
+        fc->paused_at = ktime_get();
+        fc->pauses++;
+        D(TAG, "Paused the sender with %d bytes buffered", buffered);
+
+        // the readers which emptied the buffer before the flag was visible skipped 
+        // the lock, so nobody else would resume the sender, check the size again
+        smp_mb();
+        buffered = fc->buffered_size(fc->args);
+    }
+    if (fc->paused && buffered <= fc->low) {
+        _resume(fc);
+    }
+    softirq_unlock(&fc->lock);
+}
+
+static int flow_control_show(struct seq_file * s, void * unused)
+{
+    _PFlowControl fc = (_PFlowControl) s->private;
+
+    softirq_lock(&fc->lock);
+    s64 current_pause_us = fc->paused ? ktime_us_delta(ktime_get(), fc->paused_at) : 0;
+    seq_printf(s, "backend: %s\nline: %d\nhigh: %zu\nlow: %zu\n",
+            fc->backend->name, fc->line, fc->high, fc->low);
+    if (&fake_backend == fc->backend) {
+        seq_printf(s, "fake_level: %d\n", (fc->fake_level >> fc->line) & 1);
+    }
+    seq_printf(s, "paused: %d\npauses: %lu\ntotal_pause_us: %lld\nmax_pause_us: %lld\n"
+            "current_pause_us: %lld\n",
+            fc->paused, fc->pauses, fc->total_pause_us + current_pause_us,
+            MAX(fc->max_pause_us, current_pause_us), current_pause_us);
+    softirq_unlock(&fc->lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(flow_control);
+
+void init_flow_control_debugfs(PFlowControl f, struct dentry * dir)
+{
+    if (!f) return;
+    CONVERT(fc, f);
+
+    debugfs_create_file("flow_control", 0400, dir, fc, &flow_control_fops);
+}
+
+void release_flow_control(PFlowControl f)
+{
+    if (!f) return;
+    CONVERT(fc, f);
+
+    softirq_lock(&fc->lock);
+    if (fc->paused) _resume(fc);
+    softirq_unlock(&fc->lock);
+
+    lock_stat_unregister(&fc->lock);
+    release_mem((void *) fc);
+}
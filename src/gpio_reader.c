@@ -4,6 +4,7 @@
 # include <linux/delay.h>
 # include <linux/slab.h> // For `kmalloc`
 # include <linux/string.h>
+# include <linux/bitops.h>
 # include <linux/platform_device.h>
 
 # if LINUX_VERSION_CODE > KERNEL_VERSION(3, 3, 0)
@@ -26,6 +27,9 @@ typedef struct {
     GPIOReader inner;
 
     u32 gpio_base;
+    // the output lines driven by the users of the reader, e.g., the flow control,
+    // which are left at their levels when the reader is released
+    unsigned long claimed_lines;
 } _GReader;
 
 struct gpio gpio_pins[] = {
@@ -77,28 +81,27 @@ u8 _read_half_byte(u32 base)
     return r;
 }
 
-static void _write_to_gpio(u32 base, char c)
+// the GPIOs configured as outputs, in the order of the bits written by `_write_to_gpio`
+static const int output_lines[] = { 8, 18, 23, 25 };
+
+static void _write_line(u32 base, int line, int value)
 {
     volatile unsigned *gpio_set, *gpio_clear;
 
     gpio_set = (unsigned *)((char *)base + 0x1c);
     gpio_clear = (unsigned *)((char *)base + 0x28);
 
-    if(c & 1) *gpio_set = 1 << 8;
-    else *gpio_clear = 1 << 8;
-    udelay(1);
-
-    if(c & 2) *gpio_set = 1 << 18;
-    else *gpio_clear = 1 << 18;
-    udelay(1);
-
-    if(c & 4) *gpio_set = 1 << 23;
-    else *gpio_clear = 1 << 23;
-    udelay(1);
+    if (value) *gpio_set = 1 << line;
+    else *gpio_clear = 1 << line;
+}
 
-    if(c & 8) *gpio_set = 1 << 25;
-    else *gpio_clear = 1 << 25;
-    udelay(1);
+static void _write_to_gpio(u32 base, char c, unsigned long skipped_lines)
+{
+    for (int i = 0; i < ARRAY_SIZE(output_lines); i++) {
+        if (skipped_lines & (1UL << output_lines[i])) continue;
+        _write_line(base, output_lines[i], c & (1 << i));
+        udelay(1);
+    }
 }
 
 
@@ -138,7 +141,7 @@ PGPIOReader create_new_gpio_reader(irqreturn_t (* handler)(int, void *))
     }
 
     // light up all the led on the dummy device
-    _write_to_gpio(reader->gpio_base, 15);
+    _write_to_gpio(reader->gpio_base, 15, 0);
     return &reader->inner;
 
 e_with_array:
@@ -156,7 +159,8 @@ void release_gpio_reader(PGPIOReader reader)
     if (NULL == reader) return;
 
     CONVERT(r, reader);
-    _write_to_gpio(r->gpio_base, 1);
+    // don't touch the claimed lines, e.g., the sender stays resumed on the flow line
+    _write_to_gpio(r->gpio_base, 1, READ_ONCE(r->claimed_lines));
     free_irq(reader->irq_num, NULL);
     gpio_free_array(gpio_pins, ARRAY_SIZE(gpio_pins));
     iounmap((void *) r->gpio_base);
@@ -168,3 +172,21 @@ char read_half_byte_from_reader(PGPIOReader reader)
     CONVERT(r, reader);
     return _read_half_byte(r->gpio_base);
 }
+
+int is_output_line_of_reader(int line)
+{
+    for (int i = 0; i < ARRAY_SIZE(output_lines); i++) {
+        if (output_lines[i] == line) return 1;
+    }
+    return 0;
+}
+
+int write_line_of_reader(PGPIOReader reader, int line, int value)
+{
+    if (!is_output_line_of_reader(line)) return -EINVAL;
+
+    CONVERT(r, reader);
+    set_bit(line, &r->claimed_lines);
+    _write_line(r->gpio_base, line, value);
+    return SUCC;
+}
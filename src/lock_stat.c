@@ -0,0 +1,171 @@
+# include <linux/kernel.h>
+# include <linux/debugfs.h>
+# include <linux/fs.h>
+# include <linux/seq_file.h>
+# include <linux/spinlock.h>
+# include <linux/uaccess.h>
+# include <linux/ktime.h>
+
+# include "common.h"
+# include "lock_stat.h"
+
+# define TAG "LockStat"
+
+// how many locks can be registered at the same time
+# define MAX_LOCK_STATS 8
+// the upper bound of bucket i is 2^(i + 7) ns, from 128 ns to more than 2 ms
+# define LOCK_STAT_BUCKETS 16
+# define LOCK_STAT_MIN_SHIFT 7
+
+typedef struct {
+    void * lock;
+    const char * name;
+    // all the statistics are updated with the lock held, so they need no atomics
+    unsigned long acquisitions;
+    unsigned long contended;
+    unsigned long wait_hist[LOCK_STAT_BUCKETS];
+    unsigned long hold_hist[LOCK_STAT_BUCKETS];
+    u64 total_wait_ns;
+    u64 total_hold_ns;
+    // when the current holder acquired the lock
+    u64 hold_start;
+} LockStat;
+
+typedef LockStat * PLockStat;
+
+static LockStat lock_stats[MAX_LOCK_STATS];
+
+// protects the registration, the statistics of a lock are protected by the lock itself
+static DEFINE_SPINLOCK(registry_lock);
+
+static PLockStat _find_lock_stat(void * lock)
+{
+    for (int i = 0; i < MAX_LOCK_STATS; i++) {
+        if (READ_ONCE(lock_stats[i].lock) == lock) return &lock_stats[i];
+    }
+    return NULL;
+}
+
+static int _bucket(u64 ns)
+{
+    return clamp(fls64(ns >> LOCK_STAT_MIN_SHIFT), 0, LOCK_STAT_BUCKETS - 1);
+}
+
+void lock_stat_register(void * lock, const char * name)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&registry_lock, flags);
+    PLockStat stat = _find_lock_stat(NULL);
+    if (stat) {
+        memset(stat, 0, sizeof(LockStat));
+        stat->name = name;
+        WRITE_ONCE(stat->lock, lock);
+    } else {
+        W(TAG, "Unable to register the statistics of %s", name);
+    }
+    spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+void lock_stat_unregister(void * lock)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&registry_lock, flags);
+    PLockStat stat = _find_lock_stat(lock);
+    if (stat) {
+        WRITE_ONCE(stat->lock, NULL);
+    }
+    spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+void lock_stat_acquired(void * lock, int contended, u64 wait_ns)
+{
+    PLockStat stat = _find_lock_stat(lock);
+    if (!stat) return;
+
+    stat->acquisitions++;
+    // the uncontended ones never wait, counting them would hide the short waits
+    if (contended) {
+        stat->contended++;
+        stat->total_wait_ns += wait_ns;
+        stat->wait_hist[_bucket(wait_ns)]++;
+    }
+    stat->hold_start = ktime_get_ns();
+}
+
+void lock_stat_released(void * lock)
+{
+    PLockStat stat = _find_lock_stat(lock);
+    if (!stat) return;
+
+    u64 hold_ns = ktime_get_ns() - stat->hold_start;
+    stat->total_hold_ns += hold_ns;
+    stat->hold_hist[_bucket(hold_ns)]++;
+}
+
+static void _show_histogram(struct seq_file * s, const char * title, unsigned long * hist)
+{
+    seq_printf(s, "  %s:", title);
+    for (int i = 0; i < LOCK_STAT_BUCKETS; i++) {
+        seq_printf(s, " %s%lluns:%lu", i == LOCK_STAT_BUCKETS - 1 ? ">=" : "<", 
+                1ULL << (i == LOCK_STAT_BUCKETS - 1 ? i + LOCK_STAT_MIN_SHIFT - 1 
+                    : i + LOCK_STAT_MIN_SHIFT), hist[i]);
+    }
+    seq_putc(s, '\n');
+}
+
+static int lock_stat_show(struct seq_file * s, void * unused)
+{
+    // the statistics are read without the locks, they are only a snapshot
+    for (int i = 0; i < MAX_LOCK_STATS; i++) {
+        PLockStat stat = &lock_stats[i];
+        if (!READ_ONCE(stat->lock)) continue;
+
+        seq_printf(s, "%s:\n  acquisitions: %lu\n  contended: %lu\n"
+                "  total_wait_ns: %llu\n  total_hold_ns: %llu\n", 
+                stat->name, stat->acquisitions, stat->contended, 
+                stat->total_wait_ns, stat->total_hold_ns);
+        _show_histogram(s, "wait", stat->wait_hist);
+        _show_histogram(s, "hold", stat->hold_hist);
+    }
+    return 0;
+}
+
+static int lock_stat_open(struct inode * inode, struct file * filep)
+{
+    return single_open(filep, lock_stat_show, inode->i_private);
+}
+
+/**
+ * writing anything into the file resets the statistics of all the locks
+ */
+static ssize_t lock_stat_write(struct file * filep, const char __user * buff, 
+        size_t size, loff_t * offset)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&registry_lock, flags);
+    for (int i = 0; i < MAX_LOCK_STATS; i++) {
+        PLockStat stat = &lock_stats[i];
+        // the holder may be updating them, a reset is never exact
+        stat->acquisitions = stat->contended = 0;
+        stat->total_wait_ns = stat->total_hold_ns = 0;
+        memset(stat->wait_hist, 0, sizeof(stat->wait_hist));
+        memset(stat->hold_hist, 0, sizeof(stat->hold_hist));
+    }
+    spin_unlock_irqrestore(&registry_lock, flags);
+    return size;
+}
+
+static const struct file_operations lock_stat_fops = {
+    .owner = THIS_MODULE,
+    .open = lock_stat_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+    .write = lock_stat_write,
+};
+
+int init_lock_stat(struct dentry * dir)
+{
+    debugfs_create_file("lock_stat", 0600, dir, NULL, &lock_stat_fops);
+    return SUCC;
+}
@@ -1,6 +1,12 @@
 # include <linux/kernel.h>
-# include <linux/gfp.h>  // for `get_zeroed_page`
+# include <linux/gfp.h>  // for `__get_free_page`
 # include <linux/spinlock.h> // for spinlock_t and related functions
+# include <linux/percpu.h> // for the per-cpu magazines
+# include <linux/bottom_half.h> // for `local_bh_disable` and `local_bh_enable`
+# include <linux/moduleparam.h>
+# include <linux/debugfs.h>
+# include <linux/seq_file.h>
+# include <linux/vmalloc.h> // for the spans too large for higher-order pages
 
 # include "common.h"
 # include "mem_cache.h"
@@ -11,10 +17,32 @@
 #endif
 #define TAG "MCache"
 
+// build with `make MEM_POISON=1` to poison the released memory and verify it before 
+// being allocated again, instead of zeroing the memory
+#ifdef MEM_POISON
+// the pattern of the memory which is not allocated, any change means use-after-free
+# define POISON_FREE 0x6b
+// the pattern of the memory which is allocated but not required to be zeroed
+# define POISON_ALLOC 0xa5
+
+# define POISON_MEM(m, s) memset((m), POISON_FREE, (s))
+# define POISON_ALLOC_MEM(m, s) memset((m), POISON_ALLOC, (s))
+# define CHECK_POISON(m, s) _check_poison((m), (s))
+# define POISON_ENABLED 1
+#else
+# define POISON_MEM(m, s)
+# define POISON_ALLOC_MEM(m, s)
+# define CHECK_POISON(m, s)
+# define POISON_ENABLED 0
+#endif
+
 
 // the struct is allocated at the beginning of the page
 // after being created, there are at least 2 AllocatedRegions in the `sub_list`
 typedef struct {
+    // must be the first field, to tell the page from a span
+    unsigned int magic;
+
     unsigned long page;
     
     ListHead sub_list;
@@ -24,6 +52,37 @@ typedef struct {
 
 typedef CacheNode * PCNode;
 
+// the memory larger than a page is allocated in a span of pages (higher-order pages, 
+// or virtually contiguous pages for the very large ones), with this header at the beginning
+typedef struct {
+    // must be the first field, to tell the span from a page
+    unsigned int magic;
+
+    // order of the pages, or `SPAN_VMALLOC`
+    unsigned int order;
+    size_t size;
+    // the pages taken by the span, the higher-order pages are always `1 << order`
+    unsigned long pages;
+
+    ListHead node;
+} SpanHeader;
+
+typedef SpanHeader * PSpanHeader;
+
+# define CACHE_NODE_MAGIC 0x4d43504eU
+# define SPAN_MAGIC 0x4d435350U
+
+# define SPAN_VMALLOC ((unsigned int) -1)
+// the largest span allocated from the higher-order pages, 
+// the larger ones are allocated by vmalloc
+# define SPAN_MAX_ORDER 3
+
+// the gap between the start and the end regions of an empty page
+# define PAGE_GAP_SIZE (PAGE_SIZE - (sizeof(CacheNode) + 2 * sizeof(AllocatedRegion)))
+// the largest memory which can be allocated in a page, 
+// the region in the gap needs its own header as well
+# define MAX_REGION_SIZE (PAGE_GAP_SIZE - sizeof(AllocatedRegion))
+
 // the allocated region in the page, all this structure should be stored in the page
 typedef struct {
     unsigned int allocated_size;
@@ -34,18 +93,81 @@ typedef struct {
 
 typedef AllocatedRegion * PARegion;
 
+// the small allocations are rounded up to the size classes, 
+// the recently released objects of each size class are kept in a per-cpu magazine,
+// so that most allocations and releases don't need to take the global lock
+# define MIN_CLASS_SHIFT 4
+# define SIZE_CLASS_COUNT 6
+# define CLASS_SIZE(c) (1 << ((c) + MIN_CLASS_SHIFT))
+# define MAX_CLASS_SIZE CLASS_SIZE(SIZE_CLASS_COUNT - 1)
+
+// how many objects a magazine holds, and how many objects are moved 
+// between a magazine and the shared pages at once
+# define MAGAZINE_SIZE 16
+# define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
+typedef struct {
+    int count;
+    void * objects[MAGAZINE_SIZE];
+} Magazine;
+
+typedef Magazine * PMagazine;
+
+typedef struct {
+    Magazine magazines[SIZE_CLASS_COUNT];
+
+    // statistics of the magazines on this cpu
+    unsigned long hits;
+    unsigned long refills;
+    unsigned long flushes;
+} CpuCache;
+
+typedef CpuCache * PCpuCache;
+
+static DEFINE_PER_CPU(CpuCache, cpu_caches);
+
+static bool mem_magazine = true;
+module_param(mem_magazine, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(mem_magazine, "keep recently released small objects in per-cpu magazines");
+
 
-// global variable to store the allocated pages
-static ListHead cache_nodes;
+// the policies to choose the gap for a new allocation
+# define FIT_FIRST 0
+# define FIT_BEST 1
+// the pages are dedicated to a size class, so that the objects in a page are in same size
+# define FIT_SEGREGATED 2
 
-// spin lock to protect while allocating and releasing memory
-static spinlock_t lock;
+static int fit_policy = FIT_FIRST;
+module_param(fit_policy, int, S_IRUGO);
+MODULE_PARM_DESC(fit_policy, "policy to find memory in pages, 0: first fit, 1: best fit, "
+        "2: segregated fit");
+
+// global variable to store the allocated pages, only the first list is used 
+// unless the pages are segregated by the size classes
+static ListHead cache_nodes[SIZE_CLASS_COUNT + 1];
+
+// how many pages are allocated currently, including the pages in the spans
+static unsigned long page_count;
+
+// all the spans allocated currently
+static ListHead spans;
+static unsigned long span_count;
+
+// spin lock to protect while allocating and releasing memory, the memory is never 
+// allocated or released in the interrupt handlers, so it is taken with 
+// the bottom halves disabled, and it is nested inside the lock of the delimiter buffer
+static DEFINE_SPINLOCK(lock);
 
 PCNode _allocate_new_cache_node(void)
 {
-    unsigned long page = get_zeroed_page(GFP_KERNEL);
+    // the page is allocated with the lock held (and the bottom halves disabled 
+    // while refilling a magazine), so it must not sleep, 
+    // and it is not zeroed, all the headers are initialised explicitly
+    unsigned long page = __get_free_page(GFP_ATOMIC);
     if (page) {
+        POISON_MEM((void *) page, PAGE_SIZE);
         PCNode node = (PCNode) page;
+        node->magic = CACHE_NODE_MAGIC;
         INIT_LIST_HEAD(&node->sub_list);
         node->page = P2L(page);
 
@@ -57,7 +179,8 @@ PCNode _allocate_new_cache_node(void)
         start->start_addr = P2L(start);
         list_add_tail(&start->node, &node->sub_list);
 
-        PARegion end = (PARegion) (page + PAGE_SIZE - cache_node_size);
+        // the end region is the last thing in the page
+        PARegion end = (PARegion) (page + PAGE_SIZE - region_node_size);
         end->allocated_size = region_node_size;
         end->usage_size = 0;
         end->start_addr = P2L(end);
@@ -70,13 +193,42 @@ PCNode _allocate_new_cache_node(void)
     return NULL;
 }
 
+#ifdef MEM_POISON
+void _check_poison(void * mem, int size)
+{
+    char * corrupted = memchr_inv(mem, POISON_FREE, size);
+    if (corrupted) {
+        E(TAG, "Memory %lu was modified after being released, at offset %d", 
+                P2L(mem), (int) (corrupted - (char *) mem));
+    }
+}
+#endif
+
 int init_mem_cache(void)
 {
-    INIT_LIST_HEAD(&cache_nodes);
+    for (int i = 0; i < ARRAY_SIZE(cache_nodes); i++) {
+        INIT_LIST_HEAD(&cache_nodes[i]);
+    }
+    INIT_LIST_HEAD(&spans);
+    span_count = 0;
+    page_count = 0;
+    lock_stat_register(&lock, "mem_cache_lock");
+    if (fit_policy < FIT_FIRST || fit_policy > FIT_SEGREGATED) {
+        W(TAG, "Unknown fit policy %d, use first fit", fit_policy);
+        fit_policy = FIT_FIRST;
+    }
+    if (POISON_ENABLED) {
+        I(TAG, "The released memory is poisoned and verified");
+    }
     return SUCC;
 }
 
-void * _find_available_region_in_page(PCNode page, int size)
+/**
+ * find a gap in the page which is able to hold expected memory and an AllocatedRegion
+ * @best: find the smallest gap in the page instead of the first one
+ * @return: the region in front of the gap, NULL if no gap is large enough
+ */
+PARegion _find_gap_in_page(PCNode page, int size, int best, unsigned long * gap_size)
 {
     // there are at least 2 Region in this list, so it is safe without checking null
     PARegion last = list_first_entry(&page->sub_list, AllocatedRegion, node);
@@ -85,7 +237,8 @@ void * _find_available_region_in_page(PCNode page, int size)
 
     PListHead ptr;
     PARegion region;
-    void * result = NULL;
+    PARegion result = NULL;
+    unsigned long required_size = size + sizeof(AllocatedRegion);
 
     list_for_each(ptr, &page->sub_list) {
         region = list_entry(ptr, AllocatedRegion, node);
@@ -94,24 +247,14 @@ void * _find_available_region_in_page(PCNode page, int size)
         // be very carefull, because the type is unsigned long, 
         // which means the generated result won't be negative value
         if (region->start_addr >= last_end_addr && 
-                region->start_addr - last_end_addr >= size + sizeof(AllocatedRegion)) {
-            // find an region which has enough space to hold expected memory and an AllocatedRegion
-            D(TAG, "Found a new region, last region addr: %lu, last region size: %d", 
-                    last->start_addr, last->allocated_size);
-            PARegion tmp = (PARegion) (last->start_addr + last->allocated_size);
-            tmp->allocated_size = size + sizeof(AllocatedRegion);
-            D(TAG, "New region addr: %lu, size: %d", P2L(tmp), tmp->allocated_size);
-            tmp->usage_size = size;
-            tmp->start_addr = P2L(tmp);
-
-            // insert the new region behind the last node, make sure the order is correct
-            D(TAG, "Insert new node %lu behind last node %lu, new region addr: %lu", 
-                    P2L(&tmp->node), P2L(&last->node), P2L(tmp));
-            list_add(&tmp->node, &last->node);
-
-            result = (void *) tmp->start_addr + sizeof(AllocatedRegion);
-
-            break;
+                region->start_addr - last_end_addr >= required_size) {
+            unsigned long gap = region->start_addr - last_end_addr;
+            if (NULL == result || gap < *gap_size) {
+                result = last;
+                *gap_size = gap;
+            }
+            // an exactly matched gap is the best one
+            if (!best || gap == required_size) break;
         }
         last = region;
     }
@@ -119,64 +262,264 @@ void * _find_available_region_in_page(PCNode page, int size)
     return result;
 }
 
-void * alloc_mem(int size)
+/**
+ * create a new region in the gap behind `last`
+ */
+void * _allocate_region_behind(PARegion last, int size)
 {
-#ifdef DEBUG_M
-   return kmalloc(size, GFP_KERNEL);
-#else
-    void * result = NULL;
+    D(TAG, "Found a new region, last region addr: %lu, last region size: %d", 
+            last->start_addr, last->allocated_size);
+    PARegion tmp = (PARegion) (last->start_addr + last->allocated_size);
+    tmp->allocated_size = size + sizeof(AllocatedRegion);
+    D(TAG, "New region addr: %lu, size: %d", P2L(tmp), tmp->allocated_size);
+    tmp->usage_size = size;
+    tmp->start_addr = P2L(tmp);
+
+    // insert the new region behind the last node, make sure the order is correct
+    D(TAG, "Insert new node %lu behind last node %lu, new region addr: %lu", 
+            P2L(&tmp->node), P2L(&last->node), P2L(tmp));
+    list_add(&tmp->node, &last->node);
+
+    return (void *) tmp->start_addr + sizeof(AllocatedRegion);
+}
+
+/**
+ * @return: index of the size class, or -1 if the size is too large for the magazines
+ */
+int _size_class(int size)
+{
+    if (size > MAX_CLASS_SIZE) return -1;
+    if (size <= CLASS_SIZE(0)) return 0;
+    return fls(size - 1) - MIN_CLASS_SHIFT;
+}
+
+/**
+ * the list of pages the memory of `size` bytes is allocated from
+ */
+PListHead _pages_for_size(int size)
+{
+    if (FIT_SEGREGATED != fit_policy) return &cache_nodes[0];
 
-    spin_lock_wrapper(&lock);
+    // each size class has its own pages, the other sizes share the last list
+    int size_class = _size_class(size);
+    return &cache_nodes[size_class >= 0 ? size_class : SIZE_CLASS_COUNT];
+}
 
-    // the required memory is too large for the module to manege
-    if (size > PAGE_SIZE - (sizeof(CacheNode) + 2 * sizeof(AllocatedRegion))) goto release;
+/**
+ * allocate memory from the shared pages, must be called with the lock held
+ */
+void * _alloc_from_pages(int size)
+{
+    // the required memory is too large for a page
+    if (size > MAX_REGION_SIZE) return NULL;
 
+    PListHead pages = _pages_for_size(size);
+    int best = FIT_BEST == fit_policy;
     PListHead ptr;
     PCNode curr;
+    PARegion target = NULL;
+    unsigned long target_gap = 0;
 
-    list_for_each(ptr, &cache_nodes) {
+    list_for_each(ptr, pages) {
         // check all regions to find a available memory node
         curr = list_entry(ptr, CacheNode, node);
         
-        result = _find_available_region_in_page(curr, size);
-        if (NULL != result) {
-            goto release;
+        unsigned long gap = 0;
+        PARegion last = _find_gap_in_page(curr, size, best, &gap);
+        if (NULL != last && (NULL == target || gap < target_gap)) {
+            target = last;
+            target_gap = gap;
+            if (!best || gap == size + sizeof(AllocatedRegion)) break;
         }
     }
-    D(TAG, "Didn't find an available region, try to create a new page_node");
-    // no available region for new allocation, create a new page
-    PCNode page_node = _allocate_new_cache_node();
-    if (NULL != page_node) {
-        list_add_tail(&page_node->node, &cache_nodes);
 
-        result = _find_available_region_in_page(page_node, size);
+    if (NULL == target) {
+        D(TAG, "Didn't find an available region, try to create a new page_node");
+        // no available region for new allocation, create a new page
+        PCNode page_node = _allocate_new_cache_node();
+        if (NULL != page_node) {
+            list_add_tail(&page_node->node, pages);
+            page_count++;
+
+            target = _find_gap_in_page(page_node, size, 0, &target_gap);
+        }
     }
-release:
-    spin_unlock_wrapper(&lock);
-    
-    return result;
-#endif
+    return target ? _allocate_region_behind(target, size) : NULL;
 }
 
-void _release_region_in_page(PCNode page, void *mem)
+/**
+ * release memory back to the shared pages, must be called with the lock held
+ */
+void _release_to_pages(void * mem)
 {
-    PListHead ptr;
-    PARegion curr;
+    // the CacheNode is always at the beginning of the page
+    PCNode curr = (PCNode) (P2L(mem) & PAGE_MASK);
+    PARegion region = (PARegion) ((char *) mem - sizeof(AllocatedRegion));
+
+    // found the corresponding AllocatedRegion, delete the node from list first
+    list_del(&region->node);
+    // the memory is not zeroed, the allocation zeroes the memory only if required
+    POISON_MEM((void *) region->start_addr, region->allocated_size);
+
+    // check if there is no any allocated region now, if so, release this page
+    // there should be at least 2 entries in the list
+    PARegion start = list_first_entry(&curr->sub_list, AllocatedRegion, node);
+    PARegion end = list_last_entry(&curr->sub_list, AllocatedRegion, node);
+    if (list_next_entry(start, node) == end) {
+        // only 2 entries in the list, release this page
+        list_del(&curr->node);
+        free_page((unsigned long) curr->page);
+        page_count--;
+    }
+}
 
-    unsigned long addr = (unsigned long) mem;
+/**
+ * allocate the memory larger than a page in a span
+ * @flags: the higher-order pages are allocated atomically, 
+ *         unless `MEM_SLEEPABLE` permits to sleep and fall back to vmalloc
+ */
+void * _alloc_span(int size, int flags)
+{
+    size_t total_size = size + sizeof(SpanHeader);
+    int order = get_order(total_size);
+    PSpanHeader span = NULL;
 
-    list_for_each(ptr, &page->sub_list) {
-        curr = list_entry(ptr, AllocatedRegion, node);
-        
-        if (addr - sizeof(AllocatedRegion) == curr->start_addr) {
-            // found the corresponding AllocatedRegion, delete the node from list first
-            list_del(&curr->node);
+    if (order <= SPAN_MAX_ORDER) {
+        gfp_t gfp = (flags & MEM_SLEEPABLE) ? GFP_KERNEL : GFP_ATOMIC;
+        span = (PSpanHeader) __get_free_pages(gfp | __GFP_NOWARN, order);
+    }
+    if (NULL == span && (flags & MEM_SLEEPABLE)) {
+        // too large or too fragmented for the higher-order pages
+        span = (PSpanHeader) vmalloc(total_size);
+        order = SPAN_VMALLOC;
+    }
+    if (NULL == span) {
+        E(TAG, "Unable to allocate a span for %d bytes", size);
+        return NULL;
+    }
 
-            // clean up this chunk of memory
-            memset((void *)curr->start_addr, 0, curr->allocated_size);
-            break;
+    span->magic = SPAN_MAGIC;
+    span->order = order;
+    span->size = total_size;
+    span->pages = SPAN_VMALLOC == order ? PAGE_ALIGN(total_size) >> PAGE_SHIFT : 1UL << order;
+    POISON_MEM((void *) (span + 1), size);
+
+    softirq_lock(&lock);
+    list_add_tail(&span->node, &spans);
+    span_count++;
+    page_count += span->pages;
+    softirq_unlock(&lock);
+
+    D(TAG, "Allocated a span %lu for %d bytes, order: %d", P2L(span), size, order);
+    return (void *) (span + 1);
+}
+
+/**
+ * return the pages of the span which has been removed from the list
+ */
+void _free_span_pages(PSpanHeader span)
+{
+    if (SPAN_VMALLOC == span->order) {
+        vfree(span);
+    } else {
+        free_pages(P2L(span), span->order);
+    }
+}
+
+void _release_span(PSpanHeader span)
+{
+    softirq_lock(&lock);
+    list_del(&span->node);
+    span_count--;
+    page_count -= span->pages;
+    softirq_unlock(&lock);
+
+    _free_span_pages(span);
+}
+
+/**
+ * move a batch of objects from the shared pages into the magazine, 
+ * must be called with the bottom halves disabled
+ */
+void _refill_magazine(PMagazine m, int size_class)
+{
+    softirq_lock(&lock);
+    while (m->count < MAGAZINE_BATCH) {
+        void * object = _alloc_from_pages(CLASS_SIZE(size_class));
+        if (NULL == object) break;
+        m->objects[m->count++] = object;
+    }
+    softirq_unlock(&lock);
+}
+
+/**
+ * move a batch of objects from the magazine back to the shared pages, 
+ * must be called with the bottom halves disabled
+ */
+void _flush_magazine(PMagazine m, int count)
+{
+    softirq_lock(&lock);
+    while (count-- > 0 && m->count > 0) {
+        _release_to_pages(m->objects[--m->count]);
+    }
+    softirq_unlock(&lock);
+}
+
+/**
+ * allocate memory without zeroing it, used if the memory is going to be overwritten
+ */
+void * alloc_mem(int size)
+{
+    return alloc_mem_flags(size, 0);
+}
+
+/**
+ * @flags: `MEM_ZERO` to zero the allocated memory, 
+ *         `MEM_SLEEPABLE` if the caller is able to sleep
+ */
+void * alloc_mem_flags(int size, int flags)
+{
+#ifdef DEBUG_M
+   return kmalloc(size, GFP_ATOMIC | ((flags & MEM_ZERO) ? __GFP_ZERO : 0));
+#else
+    void * result = NULL;
+    int size_class = mem_magazine ? _size_class(size) : -1;
+
+    if (size > MAX_REGION_SIZE) {
+        result = _alloc_span(size, flags);
+    } else if (size_class >= 0) {
+        // the magazines are used in both process context and the tasklet, 
+        // but never in the interrupt handlers
+        local_bh_disable();
+        PCpuCache cache = this_cpu_ptr(&cpu_caches);
+        PMagazine m = &cache->magazines[size_class];
+        if (0 == m->count) {
+            _refill_magazine(m, size_class);
+            cache->refills++;
+        } else {
+            cache->hits++;
+        }
+        if (m->count > 0) {
+            result = m->objects[--m->count];
+        }
+        local_bh_enable();
+    } else {
+        softirq_lock(&lock);
+        result = _alloc_from_pages(size);
+        softirq_unlock(&lock);
+    }
+
+    if (NULL != result) {
+        CHECK_POISON(result, size);
+        if (flags & MEM_ZERO) {
+            memset(result, 0, size);
+        } else {
+            POISON_ALLOC_MEM(result, size);
         }
     }
+    
+    return result;
+#endif
 }
 
 void release_mem(void * mem)
@@ -185,46 +528,158 @@ void release_mem(void * mem)
 #ifdef DEBUG_M
     kfree(mem);
 #else
-    PListHead ptr;
-    PCNode curr;
+    // both the page and the span have the magic number at the beginning of the page
+    unsigned int magic = * (unsigned int *) (P2L(mem) & PAGE_MASK);
+    if (SPAN_MAGIC == magic) {
+        _release_span((PSpanHeader) mem - 1);
+        return;
+    }
 
-    unsigned long addr = (unsigned long) mem;
+    PARegion region = (PARegion) ((char *) mem - sizeof(AllocatedRegion));
+    // only the objects allocated for the size classes can be kept in the magazines
+    int size_class = _size_class(region->usage_size);
+    if (mem_magazine && size_class >= 0 && region->usage_size == CLASS_SIZE(size_class)) {
+        POISON_MEM(mem, region->usage_size);
+
+        local_bh_disable();
+        PCpuCache cache = this_cpu_ptr(&cpu_caches);
+        PMagazine m = &cache->magazines[size_class];
+        if (MAGAZINE_SIZE == m->count) {
+            _flush_magazine(m, MAGAZINE_BATCH);
+            cache->flushes++;
+        }
+        m->objects[m->count++] = mem;
+        local_bh_enable();
+        return;
+    }
 
-    spin_lock_wrapper(&lock);
+    softirq_lock(&lock);
+    _release_to_pages(mem);
+    softirq_unlock(&lock);
+#endif
+}
 
-    list_for_each(ptr, &cache_nodes) {
-        curr = list_entry(ptr, CacheNode, node);
+void mem_cache_stat(unsigned long * hits, unsigned long * refills, unsigned long * flushes)
+{
+    int cpu;
+    *hits = *refills = *flushes = 0;
+    for_each_possible_cpu(cpu) {
+        PCpuCache cache = per_cpu_ptr(&cpu_caches, cpu);
+        *hits += cache->hits;
+        *refills += cache->refills;
+        *flushes += cache->flushes;
+    }
+}
 
-        if (addr > curr->page && addr < curr->page + PAGE_SIZE) {
-            // the memory should be in this page
-            _release_region_in_page(curr, mem);
-
-            // check if there is no any allocated region now, if so, release this page
-            // there should be at least 2 entries in the list
-            PARegion start = list_first_entry(&curr->sub_list, AllocatedRegion, node);
-            PARegion end = list_last_entry(&curr->sub_list, AllocatedRegion, node);
-            if (list_next_entry(start, node) == end) {
-                // only 2 entries in the list, release this page
-                list_del(&curr->node);
-                free_page((unsigned long) curr->page);
-                break;
+unsigned long mem_cache_pages(void)
+{
+    return READ_ONCE(page_count);
+}
+
+// the buckets of the free gap histogram, the upper bound of bucket i is 2^(i + 5) bytes
+# define GAP_BUCKETS 8
+
+static int mem_cache_show(struct seq_file * s, void * unused)
+{
+    unsigned long gaps[GAP_BUCKETS] = { 0 };
+    unsigned long total_objects = 0, total_used = 0, pinned_pages = 0;
+    unsigned long hits, refills, flushes;
+    const int usable_size = PAGE_GAP_SIZE;
+
+    static const char * policies[] = { "first", "best", "segregated" };
+    seq_printf(s, "policy: %s\npoison: %d\n", policies[fit_policy], POISON_ENABLED);
+    seq_puts(s, "page list objects used_bytes utilisation(%)\n");
+
+    softirq_lock(&lock);
+    for (int i = 0; i < ARRAY_SIZE(cache_nodes); i++) {
+        PCNode page;
+        list_for_each_entry(page, &cache_nodes[i], node) {
+            PARegion last = list_first_entry(&page->sub_list, AllocatedRegion, node);
+            PARegion end = list_last_entry(&page->sub_list, AllocatedRegion, node);
+            PARegion region;
+            unsigned long objects = 0, used = 0;
+
+            list_for_each_entry(region, &page->sub_list, node) {
+                if (region != last) {
+                    unsigned long gap = region->start_addr 
+                        - (last->start_addr + last->allocated_size);
+                    if (gap > 0) {
+                        gaps[clamp(fls(gap >> 5), 0, GAP_BUCKETS - 1)]++;
+                    }
+                }
+                if (region != end && region != last) {
+                    objects++;
+                    used += region->usage_size;
+                }
+                last = region;
             }
+
+            // a page kept by only one object
+            if (1 == objects) pinned_pages++;
+            total_objects += objects;
+            total_used += used;
+            seq_printf(s, "%lx %d %lu %lu %lu\n", page->page, i, objects, used, 
+                    used * 100 / usable_size);
         }
     }
+    unsigned long pages = page_count;
+    unsigned long spans_in_use = span_count;
+    unsigned long span_pages = 0;
+    PSpanHeader span;
+    list_for_each_entry(span, &spans, node) {
+        span_pages += span->pages;
+    }
+    softirq_unlock(&lock);
+
+    seq_printf(s, "pages: %lu\nobjects: %lu\nused_bytes: %lu\nspans: %lu\nspan_pages: %lu\n", 
+            pages - span_pages, total_objects, total_used, spans_in_use, span_pages);
+    seq_printf(s, "utilisation(%%): %lu\n", 
+            pages > span_pages ? total_used * 100 / ((pages - span_pages) * usable_size) : 0);
+    seq_printf(s, "pinned_by_single_object: %lu\n", pinned_pages);
+    seq_puts(s, "free_gaps:");
+    for (int i = 0; i < GAP_BUCKETS; i++) {
+        seq_printf(s, " %s%d:%lu", i == GAP_BUCKETS - 1 ? ">=" : "<", 
+                1 << (i == GAP_BUCKETS - 1 ? i + 4 : i + 5), gaps[i]);
+    }
+    seq_putc(s, '\n');
 
-    spin_unlock_wrapper(&lock);
-#endif
+    mem_cache_stat(&hits, &refills, &flushes);
+    seq_printf(s, "magazine_hits: %lu\nmagazine_refills: %lu\nmagazine_flushes: %lu\n", 
+            hits, refills, flushes);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mem_cache);
+
+void init_mem_cache_debugfs(struct dentry * dir)
+{
+    debugfs_create_file("mem_cache", 0400, dir, NULL, &mem_cache_fops);
 }
 
 void release_mem_cache(void)
 {
-    while (!list_empty(&cache_nodes)) {
-        PCNode tmp_node = list_first_entry_or_null(&cache_nodes, CacheNode, node);
+    int cpu;
+    lock_stat_unregister(&lock);
+    // the objects in the magazines are released with their pages
+    for_each_possible_cpu(cpu) {
+        PCpuCache cache = per_cpu_ptr(&cpu_caches, cpu);
+        memset(cache, 0, sizeof(CpuCache));
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(cache_nodes); i++) {
+        while (!list_empty(&cache_nodes[i])) {
+            PCNode tmp_node = list_first_entry_or_null(&cache_nodes[i], CacheNode, node);
 
-        if (NULL != tmp_node) {
-            list_del(&tmp_node->node);
-            free_page((unsigned long) tmp_node->page);
+            if (NULL != tmp_node) {
+                list_del(&tmp_node->node);
+                free_page((unsigned long) tmp_node->page);
+            }
         }
     }
+    while (!list_empty(&spans)) {
+        PSpanHeader span = list_first_entry(&spans, SpanHeader, node);
+        list_del(&span->node);
+        _free_span_pages(span);
+    }
+    span_count = 0;
+    page_count = 0;
 }
-
@@ -0,0 +1,126 @@
+# include <linux/kernel.h>
+# include <linux/types.h>
+# include <linux/mm.h>
+# include <linux/rcupdate.h>
+# include <linux/bottom_half.h>
+# include <linux/skbuff.h>
+# include <linux/filter.h>
+# include <linux/bpf.h>
+
+# include "common.h"
+# include "mem_cache.h"
+# include "msg_filter.h"
+
+#ifdef CONFIG_BPF_SYSCALL
+
+# define TAG "MsgFilter"
+
+# define CONVERT(p, f) _PMsgFilter p = _convert((f))
+
+typedef struct {
+    MsgFilter inner;
+    struct bpf_prog * prog;
+} _MsgFilter;
+
+typedef _MsgFilter * _PMsgFilter;
+
+inline _PMsgFilter _convert(PMsgFilter f)
+{
+    return (_PMsgFilter) ((char *) f - offsetof(_MsgFilter, inner));
+}
+
+PMsgFilter create_msg_filter(int fd)
+{
+    struct bpf_prog * prog = bpf_prog_get_type(fd, BPF_PROG_TYPE_SOCKET_FILTER);
+    if (IS_ERR(prog)) {
+        E(TAG, "Unable to get the socket filter program of fd %d", fd);
+        return (PMsgFilter) prog;
+    }
+
+    _PMsgFilter f = (_PMsgFilter) alloc_mem_flags(sizeof(_MsgFilter),
+            MEM_ZERO | MEM_SLEEPABLE);
+    if (!f) {
+        bpf_prog_put(prog);
+        return (PMsgFilter) ERR_PTR(-ENOMEM);
+    }
+    f->prog = prog;
+    return &f->inner;
+}
+
+/**
+ * attach the fragments of the message to an empty packet as its pages,
+ * a message with more fragments than a packet can hold is truncated,
+ * the program still knows the full length from the mark of the packet
+ */
+static struct sk_buff * _build_skb(PPBufferIter it, size_t size)
+{
+    struct sk_buff * skb = alloc_skb(0, GFP_KERNEL);
+    if (!skb) return NULL;
+
+    void * ptr;
+    size_t len;
+    int nr_frags = 0;
+    while (nr_frags < MAX_SKB_FRAGS && pbuffer_iter_next(it, &ptr, &len)) {
+        // the pages are borrowed from the buffer, no reference is taken
+        skb_fill_page_desc(skb, nr_frags++, virt_to_page(ptr), offset_in_page(ptr), len);
+        skb->len += len;
+        skb->data_len += len;
+    }
+    skb->truesize += skb->data_len;
+    skb->mark = (u32) size;
+    return skb;
+}
+
+static void _release_skb(struct sk_buff * skb)
+{
+    // detach the borrowed pages, so they aren't released with the packet
+    skb_shinfo(skb)->nr_frags = 0;
+    skb->truesize -= skb->data_len;
+    skb->len = 0;
+    skb->data_len = 0;
+    consume_skb(skb);
+}
+
+int run_msg_filter(PMsgFilter filter, PDBuffer pb)
+{
+    CONVERT(f, filter);
+    PBufferIter it;
+    int verdict = ASGN2_FILTER_DELIVER;
+
+    size_t size = dbuffer_iter_record(pb, &it);
+    struct sk_buff * skb = _build_skb(&it, size);
+    if (!skb) {
+        // never lose a message because of the filter
+        W(TAG, "Unable to build the packet for the message of %d bytes", size);
+        goto end_iter;
+    }
+
+    // the same context as a socket filter runs in
+    local_bh_disable();
+    rcu_read_lock();
+    u32 ret = bpf_prog_run_save_cb(f->prog, skb);
+    rcu_read_unlock();
+    local_bh_enable();
+
+    if (ASGN2_FILTER_DROP == ret || ASGN2_FILTER_ROUTE == ret) {
+        verdict = ret;
+    }
+    D(TAG, "The verdict of the message of %d bytes is %d", size, verdict);
+
+    _release_skb(skb);
+
+end_iter:
+    dbuffer_end_iter(pb, &it);
+    return verdict;
+}
+
+void release_msg_filter(PMsgFilter filter)
+{
+    if (!filter) return;
+    CONVERT(f, filter);
+
+    bpf_prog_put(f->prog);
+    release_mem((void *) f);
+}
+
+#endif // CONFIG_BPF_SYSCALL
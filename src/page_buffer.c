@@ -1,6 +1,13 @@
-# include <linux/gfp.h>  // for `get_zeroed_page`
+# include <linux/gfp.h>
+# include <linux/bottom_half.h> // for `local_bh_disable` and `local_bh_enable`
+# include <linux/mm.h> // for `folio_alloc` and `folio_put`
+# include <linux/moduleparam.h>
+# include <linux/rcupdate.h>
+# include <linux/scatterlist.h>
 # include <linux/string.h> // for operations of string 
 # include <linux/uaccess.h> // for `copy_from_user` and `copy_to_user`
+# include <linux/xarray.h>
+# include <linux/jiffies.h>
 
 
 # include "common.h"
@@ -12,22 +19,70 @@
 #define CONVERT(f, l) _PPBuffer f = _convert_pbuffer((l));
 
 #define NODE_SIZE(n) ((n)->end_pos - (n)->start_pos)
-#define NODE_AVAILABLE_SIZE(n) (PAGE_SIZE - (n)->end_pos)
+#define NODE_AVAILABLE_SIZE(n) ((n)->capacity - (n)->end_pos)
 #define NODE_START_POS(n) ((n)->page + (n)->start_pos)
 #define NODE_END_POS(n) ((n)->page + (n)->end_pos)
-#define NODE_IS_FULL(n) ((n)->end_pos == PAGE_SIZE)
+#define NODE_IS_FULL(n) ((n)->end_pos == (n)->capacity)
+// the header is stored at the beginning of the chunk, in front of the data
+#define NODE_IS_INLINE(n) ((n)->page == (void *) ((n) + 1))
 
+// the largest chunk is 2 MiB with 4 KiB pages
+#define MAX_CHUNK_ORDER 9
+
+static int chunk_order = 0;
+module_param(chunk_order, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(chunk_order, "order of the pages in each chunk of the endless buffer, "
+        "0 (4 KiB) to 9 (2 MiB)");
+
+static bool inline_chunk_header = true;
+module_param(inline_chunk_header, bool, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(inline_chunk_header, "store the header of each chunk inside the chunk itself");
+
+static int retain_bytes = 0;
+module_param(retain_bytes, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(retain_bytes, "bytes of the consumed data kept for the positional reads, 0 for no limit");
+
+static int retain_ms = 0;
+module_param(retain_ms, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(retain_ms, "milliseconds the consumed data is kept for the positional reads, 0 for no limit");
+
+// the header of a chunk, which is either stored at the beginning of the chunk, 
+// or allocated separately
 typedef struct {
+    // the data of the chunk, which is in a folio of `2^order` pages
     void * page;
+    size_t capacity;
     size_t start_pos;
     size_t end_pos;
-    ListHead node;
+    // the absolute stream offset of the first byte of `page`
+    u64 offset;
+    // the sequence number of the chunk, which is its index in `chunks`
+    unsigned long seq;
+    // when all the data of the chunk was consumed, in jiffies
+    unsigned long consumed_at;
+    // the chunk is released after the lockless readers have left it
+    struct rcu_head rcu;
 } PageNode;
 typedef PageNode * PPageNode;
 
 typedef struct {
     PBuffer inner;
-    ListHead pages; 
+    // the chunks indexed by their sequence numbers, from `head` to `tail - 1`,
+    // the sequence numbers rather than the offsets are used as the indexes 
+    // as `unsigned long` is only 32 bits on some platforms
+    struct xarray chunks;
+    unsigned long head;
+    unsigned long tail;
+    // the chunks from `reclaim` to `head - 1` have been consumed, but they are 
+    // still referenced by the pinned fragments or kept in the retention window, 
+    // they are released after unpinned or out of the window
+    unsigned long reclaim;
+    int pins;
+    // the absolute stream offset of the first unread byte, 
+    // both offsets are read without the lock, they must not be torn
+    atomic64_t start_offset;
+    // the absolute stream offset after the last written byte
+    atomic64_t end_offset;
 } _PBuffer;
 
 typedef _PBuffer * _PPBuffer;
@@ -41,45 +96,72 @@ _PPBuffer _convert_pbuffer(PPBuffer b)
 void _release_page_node(PPageNode n)
 {
     if (n) {
-        if (n->page) free_page((unsigned long) n->page);
+        if (NODE_IS_INLINE(n)) {
+            // the header is released with the chunk
+            folio_put(virt_to_folio(n));
+            return;
+        }
+
+        if (n->page) folio_put(virt_to_folio(n->page));
 
         release_mem((void *) n);
     }
 }
 
+/**
+ * allocate the folio for a chunk, fall back to the smaller ones 
+ * if the memory is too fragmented
+ */
+struct folio * _allocate_chunk(void)
+{
+    // the chunk is always written before read, so it doesn't need to be zeroed, 
+    // and it is allocated while the buffer is locked, so it must not sleep
+    for (int order = clamp(chunk_order, 0, MAX_CHUNK_ORDER); order >= 0; order--) {
+        struct folio * folio = folio_alloc(GFP_ATOMIC | (order ? __GFP_NOWARN : 0), order);
+        if (folio) return folio;
+    }
+    return NULL;
+}
+
 PPageNode _create_new_page_node(void)
 {
-    PPageNode node = (PPageNode) alloc_mem(sizeof(PageNode));
-    if (IS_ERR(node)) {
-        int err = PTR_ERR(node);
-        E(TAG, "Unable to allocate memory for PageNode: %d", err);
+    struct folio * folio = _allocate_chunk();
+    if (NULL == folio) {
+        E(TAG, "Unable to alocate new page for buffer");
         return NULL;
     }
-    memset(node, 0, sizeof(PageNode));
-
-    node->page = (void *) get_zeroed_page(GFP_KERNEL);
-    if (IS_ERR(node->page)) {
-        int err = PTR_ERR(node->page);
-        E(TAG, "Unable to alocate new page for buffer %d", err);
 
-        release_mem((void *) node);
-        return NULL;
+    PPageNode node = NULL;
+    if (inline_chunk_header) {
+        // no extra allocation, and the header shares the cache line with the data
+        node = (PPageNode) folio_address(folio);
+        node->page = (void *) (node + 1);
+        node->capacity = folio_size(folio) - sizeof(PageNode);
+    } else {
+        node = (PPageNode) alloc_mem(sizeof(PageNode));
+        if (NULL == node) {
+            E(TAG, "Unable to allocate memory for PageNode");
+            folio_put(folio);
+            return NULL;
+        }
+        node->page = folio_address(folio);
+        node->capacity = folio_size(folio);
     }
+    node->start_pos = 0;
+    node->end_pos = 0;
 
     return node;
 }
 
 PPBuffer create_new_pbuffer()
 {
-    _PPBuffer p = (_PPBuffer) alloc_mem(sizeof(_PBuffer));
-    if (IS_ERR(p)) {
-        int err = PTR_ERR(p);
-        E(TAG, "Unable to allocate memory for PBuffer: %d", err);
+    _PPBuffer p = (_PPBuffer) alloc_mem_flags(sizeof(_PBuffer), MEM_ZERO);
+    if (NULL == p) {
+        E(TAG, "Unable to allocate memory for PBuffer");
         return NULL;
     }
-    memset(p, 0, sizeof(_PBuffer));
 
-    INIT_LIST_HEAD(&p->pages);
+    xa_init(&p->chunks);
     return &p->inner;
 }
 
@@ -87,19 +169,123 @@ size_t pbuffer_size(PPBuffer p)
 {
     CONVERT(buff, p);
 
-    size_t size = 0;
-
-    if (!list_empty(&buff->pages)) {
-        PListHead ptr;
-        PPageNode curr;
+    // the end never moves backward, so it is read after the start
+    u64 start = atomic64_read(&buff->start_offset);
+    return atomic64_read(&buff->end_offset) - start;
+}
 
-        list_for_each(ptr, &buff->pages) {
-            curr = list_entry(ptr, PageNode, node);
-            size += NODE_SIZE(curr);
+/**
+ * find the chunk holding the byte at the absolute stream offset, 
+ * it is a binary search on the offsets of the chunks, which are increasing with 
+ * their sequence numbers, so the lookup is O(log n) instead of walking from the head.
+ * must be called with the lock held or inside a RCU read-side critical section, 
+ * without the lock NULL is returned if the chunk has been consumed meanwhile
+ */
+PPageNode _seek_chunk(_PPBuffer pb, u64 offset)
+{
+    // pairs with the release in `_append_chunk`, the chunks in the range are all indexed
+    unsigned long tail = smp_load_acquire(&pb->tail);
+    // the consumed chunks which haven't been released are still valid
+    unsigned long low = READ_ONCE(pb->reclaim);
+
+    if (low == tail) return NULL;
+
+    unsigned long high = tail - 1;
+    // look for the last chunk which starts at or before the offset
+    while (low < high) {
+        unsigned long mid = low + (high - low + 1) / 2;
+        PPageNode node = (PPageNode) xa_load(&pb->chunks, mid);
+        // the chunk which is not indexed any more is before the head
+        if (!node || node->offset <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
         }
     }
 
-    return size;
+    PPageNode node = (PPageNode) xa_load(&pb->chunks, low);
+    // the data at the offset may have been consumed by others
+    return node && node->offset <= offset ? node : NULL;
+}
+
+PPageNode _append_chunk(_PPBuffer pb)
+{
+    PPageNode node = _create_new_page_node();
+    if (!node) {
+        return NULL;
+    }
+    node->seq = pb->tail;
+    node->offset = atomic64_read(&pb->end_offset);
+
+    // the buffer is locked by the caller, so the index must not sleep either
+    int ret = xa_err(xa_store(&pb->chunks, node->seq, node, GFP_ATOMIC));
+    if (ret) {
+        E(TAG, "Unable to index the new chunk: %d", ret);
+        _release_page_node(node);
+        return NULL;
+    }
+    // publish the chunk only after it is indexed, for the lockless lookups
+    smp_store_release(&pb->tail, pb->tail + 1);
+    return node;
+}
+
+void _release_page_node_rcu(struct rcu_head * head)
+{
+    _release_page_node(container_of(head, PageNode, rcu));
+}
+
+int _retention_enabled(void)
+{
+    return READ_ONCE(retain_bytes) > 0 || READ_ONCE(retain_ms) > 0;
+}
+
+/**
+ * the consumed chunk is kept in the retention window until it falls behind 
+ * either of the limits, the window is disabled without any limit
+ */
+int _chunk_retained(_PPBuffer pb, PPageNode node)
+{
+    int bytes = READ_ONCE(retain_bytes);
+    int ms = READ_ONCE(retain_ms);
+    if (bytes <= 0 && ms <= 0) return 0;
+
+    if (bytes > 0 && node->offset + node->end_pos + bytes <= atomic64_read(&pb->start_offset)) {
+        return 0;
+    }
+    if (ms > 0 && time_after_eq(jiffies, node->consumed_at + msecs_to_jiffies(ms))) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * release the consumed chunks from the oldest one, the limits of the window are 
+ * checked when the data is consumed or written, the buffer is unpinned, 
+ * or periodically by `pbuffer_reclaim`
+ */
+void _reclaim_chunks(_PPBuffer pb, int all)
+{
+    while (pb->reclaim != pb->head) {
+        PPageNode node = (PPageNode) xa_load(&pb->chunks, pb->reclaim);
+        // the chunks behind it are consumed later, so they are kept as well
+        if (!all && _chunk_retained(pb, node)) break;
+
+        xa_erase(&pb->chunks, pb->reclaim);
+        WRITE_ONCE(pb->reclaim, pb->reclaim + 1);
+        // the lockless readers may still be walking through it
+        call_rcu(&node->rcu, _release_page_node_rcu);
+    }
+}
+
+void _drop_head_chunk(_PPBuffer pb)
+{
+    PPageNode node = (PPageNode) xa_load(&pb->chunks, pb->head);
+    node->consumed_at = jiffies;
+    WRITE_ONCE(pb->head, pb->head + 1);
+    // release it later if some fragments may still be referenced
+    if (0 == pb->pins) {
+        _reclaim_chunks(pb, 0);
+    }
 }
 
 size_t _write_into_page_node(PPageNode node, char * buff, size_t expected_size, int kernel)
@@ -123,22 +309,26 @@ size_t _write_into_pbuffer_generic(PPBuffer p, char * buff, size_t size, int ker
 
     while (already_write_size < size) {
         PPageNode node = NULL;
-        if (list_empty(&pb->pages) || NODE_IS_FULL(list_last_entry(&pb->pages, 
-                        PageNode, node))) {
-            node = _create_new_page_node();
+        if (pb->head != pb->tail) {
+            node = (PPageNode) xa_load(&pb->chunks, pb->tail - 1);
+        }
+        if (!node || NODE_IS_FULL(node)) {
+            node = _append_chunk(pb);
             if (!node) {
                 E(TAG, "Unable to create new node");
                 break;
             }
-            list_add_tail(&node->node, &pb->pages);
-        } else {
-            node = list_last_entry(&pb->pages, PageNode, node);
+            // the window moves with the written data as well
+            if (0 == pb->pins) _reclaim_chunks(pb, 0);
         }
  
         size_t write_size = _write_into_page_node(node, 
                 buff + already_write_size, size - already_write_size, kernel);
         int has_written_enough = write_size == size - already_write_size;
         already_write_size += write_size;
+        // the data must be visible before the lockless readers see the new end
+        smp_wmb();
+        atomic64_add(write_size, &pb->end_offset);
 
         if (!has_written_enough && !NODE_IS_FULL(node)) {
             // the node is not full yet, but hasn't written enough data into this node
@@ -170,14 +360,11 @@ size_t _read_from_pbuffer_generic(PPBuffer p, char * buff, size_t size, int kern
 
     size_t already_read_size = 0;
     
-    while (already_read_size < size) {
-        PPageNode node = NULL;
+    while (already_read_size < size && pb->head != pb->tail) {
+        PPageNode node = (PPageNode) xa_load(&pb->chunks, pb->head);
 
-        if (list_empty(&pb->pages) || 0 == NODE_SIZE(list_first_entry(&pb->pages, 
-                        PageNode, node))) {
+        if (0 == NODE_SIZE(node)) {
             break;
-        } else {
-            node = list_first_entry(&pb->pages, PageNode, node);
         }
         
         size_t read_size = _read_from_page_node(node, buff + already_read_size,
@@ -186,11 +373,10 @@ size_t _read_from_pbuffer_generic(PPBuffer p, char * buff, size_t size, int kern
         int has_read_enough = read_size == size - already_read_size;
 
         already_read_size += read_size;
+        atomic64_add(read_size, &pb->start_offset);
         if (NODE_SIZE(node) == 0 && NODE_IS_FULL(node)) {
-            list_del(&node->node);
-        }
-
-        if (NODE_SIZE(node) > 0 && !has_read_enough) {
+            _drop_head_chunk(pb);
+        } else if (NODE_SIZE(node) > 0 && !has_read_enough) {
             // there is still some data in this node, 
             // but not read enough data from this node
             // that means some error happen and cannot continue reading
@@ -212,29 +398,162 @@ size_t read_from_pbuffer(PPBuffer p, char * buff, size_t size)
     return _read_from_pbuffer_generic(p, buff, size, 1);
 }
 
-size_t get_from_pbuffer(PPBuffer p, char * buff, size_t size)
+size_t _get_at_offset(_PPBuffer pb, u64 offset, char * buff, size_t size, int kernel);
+
+/**
+ * copy the data from the position `pos` (relative to the first unread byte) 
+ * without consuming it, the chunk holding `pos` is found with `_seek_chunk`.
+ * the caller must make sure that there are at least `pos + size` bytes of data 
+ * in the buffer and nobody consumes the data at the same time, then it is safe 
+ * to call this function without holding the lock while the data is being appended 
+ * to the end of the buffer, as it never goes beyond the requested data.
+ * copying into kernel space runs inside a RCU read-side critical section, so it is 
+ * also safe while the data is being consumed, the chunks are not released under it, 
+ * but copying into user space may sleep, which relies on the reservation instead
+ */
+size_t _get_from_pbuffer_generic(PPBuffer p, size_t pos, char * buff, size_t size, int kernel)
 {
     CONVERT(pb, p);
 
+    return _get_at_offset(pb, atomic64_read(&pb->start_offset) + pos, buff, size, kernel);
+}
+
+/**
+ * the same as `_get_from_pbuffer_generic`, but the data is at the absolute stream 
+ * `offset`, which can be in the consumed chunks which haven't been released
+ */
+size_t _get_at_offset(_PPBuffer pb, u64 offset, char * buff, size_t size, int kernel)
+{
     size_t already_get_size = 0;
+    if (0 == size) return 0;
+
+    if (kernel) rcu_read_lock();
+
+    u64 end = atomic64_read(&pb->end_offset);
+    // pairs with the barrier in `_write_into_pbuffer_generic`, the data before the end 
+    // is visible after this point
+    smp_rmb();
+    if (end <= offset) {
+        size = 0;
+    } else if (end - offset < size) {
+        size = end - offset;
+    }
 
-    PListHead ptr;
-    PPageNode curr;
+    PPageNode curr = size ? _seek_chunk(pb, offset) : NULL;
+    size_t pos_in_node = curr ? offset - curr->offset : 0;
 
-    list_for_each(ptr, &pb->pages) {
-        curr = list_entry(ptr, PageNode, node);
+    while (curr) {
+        // the end of the last node may be moving forward by the writer
+        size_t end_pos = READ_ONCE(curr->end_pos);
+        if (end_pos <= pos_in_node) break;
 
-        size_t get_size = MIN(size - already_get_size, NODE_SIZE(curr));
-        memcpy(buff + already_get_size, NODE_START_POS(curr), get_size);
+        size_t get_size = MIN(size - already_get_size, end_pos - pos_in_node);
+        if (kernel) {
+            memcpy(buff + already_get_size, curr->page + pos_in_node, get_size);
+        } else {
+            size_t not_copy_size = copy_to_user(buff + already_get_size, 
+                    curr->page + pos_in_node, get_size);
+            if (not_copy_size > 0) {
+                // some error in the user space buffer
+                already_get_size += get_size - not_copy_size;
+                break;
+            }
+        }
         already_get_size += get_size;
         if (already_get_size == size) {
             break;
         }
+
+        curr = (PPageNode) xa_load(&pb->chunks, curr->seq + 1);
+        pos_in_node = 0;
     }
 
+    if (kernel) rcu_read_unlock();
+
     return already_get_size;
 }
 
+size_t get_from_pbuffer(PPBuffer p, char * buff, size_t size)
+{
+    return _get_from_pbuffer_generic(p, 0, buff, size, 1);
+}
+
+size_t get_from_pbuffer_into_user(PPBuffer p, char __user * buff, size_t size)
+{
+    return _get_from_pbuffer_generic(p, 0, buff, size, 0);
+}
+
+size_t get_from_pbuffer_at(PPBuffer p, size_t pos, char * buff, size_t size)
+{
+    return _get_from_pbuffer_generic(p, pos, buff, size, 1);
+}
+
+u64 pbuffer_offset(PPBuffer p)
+{
+    CONVERT(pb, p);
+
+    return atomic64_read(&pb->start_offset);
+}
+
+void pbuffer_window(PPBuffer p, u64 * start, u64 * end)
+{
+    CONVERT(pb, p);
+
+    *start = atomic64_read(&pb->start_offset);
+    *end = atomic64_read(&pb->end_offset);
+    // only the unread data without the window, 
+    // even if some consumed chunks are kept by the pins for now
+    if (!_retention_enabled()) return;
+
+    if (pb->reclaim != pb->head) {
+        // the oldest chunk kept in the window is complete
+        *start = ((PPageNode) xa_load(&pb->chunks, pb->reclaim))->offset;
+    } else if (pb->head != pb->tail) {
+        // the data consumed from the head chunk is still there
+        *start = ((PPageNode) xa_load(&pb->chunks, pb->head))->offset;
+    }
+}
+
+size_t get_from_pbuffer_at_offset_into_user(PPBuffer p, u64 offset, 
+        char __user * buff, size_t size)
+{
+    CONVERT(pb, p);
+
+    return _get_at_offset(pb, offset, buff, size, 0);
+}
+
+/**
+ * drop the data from the beginning of the buffer without copying it, 
+ * the chunk holding the new first unread byte is looked up with `_seek_chunk`, 
+ * and the chunks in front of it are dropped without touching their data, 
+ * so the cost depends on the number of the chunks instead of the bytes
+ */
+size_t discard_from_pbuffer(PPBuffer p, size_t size)
+{
+    CONVERT(pb, p);
+
+    size = MIN(size, pbuffer_size(p));
+    if (0 == size) return 0;
+
+    u64 target = atomic64_read(&pb->start_offset) + size;
+    // the chunk holding the last byte to drop
+    PPageNode last = _seek_chunk(pb, target - 1);
+    atomic64_set(&pb->start_offset, target);
+
+    while (pb->head != last->seq) {
+        PPageNode node = (PPageNode) xa_load(&pb->chunks, pb->head);
+        node->start_pos = node->end_pos;
+        _drop_head_chunk(pb);
+    }
+
+    last->start_pos = target - last->offset;
+    if (NODE_SIZE(last) == 0 && NODE_IS_FULL(last)) {
+        _drop_head_chunk(pb);
+    }
+
+    return size;
+}
+
 size_t write_into_pbuffer_from_user(PPBuffer p, char __user * buff, size_t size)
 {
     return _write_into_pbuffer_generic(p, buff, size, 0);
@@ -248,102 +567,275 @@ size_t read_from_pbuffer_into_user(PPBuffer p, char __user * buff, size_t size)
 size_t simple_char_index(void * buff, size_t size, void *arg)
 {
     char target = * ((char *) arg);
-    char * result = strnchr(buff, size, target); 
+    // `strnchr` stops at '\0', which is the delimiter of the records
+    char * result = memchr(buff, target, size); 
     if (!result) {
         return -1;
     }
     return result - (char *) buff;
 }
 
-size_t find_in_pbuffer_in_range(PPBuffer p, size_t end, 
-        size_t (*index) (void *, size_t, void *), void *args)
+/**
+ * scan the chunks from `curr` for the data in [from, to) (absolute offsets), 
+ * returns the absolute offset of the target or `to` if it is not found, 
+ * and the chunk where the scan stops is stored into `last`
+ */
+u64 _scan_chunks(_PPBuffer pb, PPageNode curr, u64 from, u64 to, 
+        size_t (*index) (void *, size_t, void *), void *args, PPageNode * last)
 {
-    size_t target_pos = -1;
+    *last = curr;
+
+    while (curr) {
+        // the data before `from` is never scanned, even if the chunk has been consumed 
+        // partially by others meanwhile
+        size_t begin = from > curr->offset ? from - curr->offset : 0;
+        size_t end_pos = READ_ONCE(curr->end_pos);
+        size_t stop = to - curr->offset < end_pos ? to - curr->offset : end_pos;
+
+        if (stop > begin) {
+            size_t index_in_node = index(curr->page + begin, stop - begin, args);
+            if (index_in_node != (size_t) -1) {
+                *last = curr;
+                return curr->offset + begin + index_in_node;
+            }
+        }
 
+        PPageNode next = (PPageNode) xa_load(&pb->chunks, curr->seq + 1);
+        if (!next || next->offset >= to) break;
+        curr = next;
+    }
+    *last = curr;
+    return to;
+}
+
+/**
+ * search the data in [start, end) (relative to the first unread byte), 
+ * the search starts from the chunk holding `start` instead of the head.
+ * it doesn't need the lock, the chunks are protected by RCU, and the positions are 
+ * relative to the first unread byte when the search starts
+ */
+size_t _find_in_pbuffer_generic(_PPBuffer pb, size_t start, size_t end, 
+        size_t (*index) (void *, size_t, void *), void *args)
+{
     if (!index) {
         index = simple_char_index;
     }
 
-    size_t node_first_pos = 0;
-    CONVERT(pb, p);
-
-    PListHead ptr;
-    PPageNode curr;
-
-    list_for_each(ptr, &pb->pages) {
-        if (node_first_pos >= end) break;
+    size_t target_pos = -1;
 
-        curr = list_entry(ptr, PageNode, node);
+    rcu_read_lock();
 
-        void * start_in_node = NODE_START_POS(curr);
-        size_t range = MIN(NODE_SIZE(curr), end - node_first_pos);
-        size_t index_in_node = index(start_in_node, range, args);
+    u64 first = atomic64_read(&pb->start_offset);
+    u64 last_written = atomic64_read(&pb->end_offset);
+    // pairs with the barrier in `_write_into_pbuffer_generic`
+    smp_rmb();
 
-        if (index_in_node >= 0) {
-            target_pos = index_in_node + node_first_pos;
-            break;
+    u64 from = first + start;
+    u64 to = first + (MIN(end, (size_t) (last_written - first)));
+    if (from < to) {
+        PPageNode last = NULL;
+        u64 target = _scan_chunks(pb, _seek_chunk(pb, from), from, to, index, args, &last);
+        if (target != to) {
+            target_pos = target - first;
         }
-
-        node_first_pos += NODE_SIZE(curr);
     }
+
+    rcu_read_unlock();
     return target_pos;
 }
 
+size_t find_in_pbuffer_in_range(PPBuffer p, size_t end, 
+        size_t (*index) (void *, size_t, void *), void *args)
+{
+    CONVERT(pb, p);
+
+    return _find_in_pbuffer_generic(pb, 0, end, index, args);
+}
+
 size_t find_in_pbuffer(PPBuffer p, size_t start_pos, 
         size_t (*index) (void *, size_t, void *), void *args)
 {
-    size_t target_pos = -1;
+    CONVERT(pb, p);
+
+    return _find_in_pbuffer_generic(pb, start_pos, -1, index, args);
+}
+
+void init_pbuffer_cursor(PPBuffer p, PPBufferCursor c)
+{
+    CONVERT(pb, p);
+
+    c->scanned = atomic64_read(&pb->start_offset);
+    c->chunk = NULL;
+    c->seq = 0;
+}
+
+size_t find_in_pbuffer_with_cursor(PPBuffer p, PPBufferCursor c, 
+        size_t (*index) (void *, size_t, void *), void *args)
+{
+    CONVERT(pb, p);
 
     if (!index) {
         index = simple_char_index;
     }
-    
-    size_t node_first_pos = 0;
 
+    size_t target_pos = -1;
+
+    rcu_read_lock();
+
+    // the data before the first unread byte may have been consumed since the last call
+    u64 first = atomic64_read(&pb->start_offset);
+    u64 to = atomic64_read(&pb->end_offset);
+    // pairs with the barrier in `_write_into_pbuffer_generic`
+    smp_rmb();
+    u64 from = c->scanned > first ? c->scanned : first;
+    if (from >= to) goto unlock;
+
+    // the remembered chunk may have been released, it is only touched if it is still 
+    // indexed, an erased chunk is released after the grace period, so the one loaded 
+    // here stays valid until the unlock. the consumed one is looked up again as well, 
+    // as `from` may have been moved far ahead of it
+    PPageNode curr = (PPageNode) xa_load(&pb->chunks, c->seq);
+    if (!curr || curr != c->chunk || curr->seq < READ_ONCE(pb->head) || curr->offset > from) {
+        curr = _seek_chunk(pb, from);
+    }
+
+    PPageNode last = NULL;
+    u64 target = _scan_chunks(pb, curr, from, to, index, args, &last);
+
+    c->chunk = last;
+    c->seq = last ? last->seq : 0;
+    if (target == to) {
+        // only the data appended after this point is scanned next time
+        c->scanned = to;
+    } else {
+        // the next call looks for the next target
+        c->scanned = target + 1;
+        target_pos = target - first;
+    }
+
+unlock:
+    rcu_read_unlock();
+    return target_pos;
+}
+
+void pbuffer_pin(PPBuffer p)
+{
+    CONVERT(pb, p);
+
+    pb->pins++;
+}
+
+void pbuffer_unpin(PPBuffer p)
+{
     CONVERT(pb, p);
 
-    PListHead ptr;
-    PPageNode cur;
+    if (0 == --pb->pins) {
+        _reclaim_chunks(pb, 0);
+    }
+}
 
-    list_for_each(ptr, &pb->pages) {
-        cur = list_entry(ptr, PageNode, node);
+unsigned long pbuffer_reclaim_delay(PPBuffer p)
+{
+    CONVERT(pb, p);
 
-        void * start_in_node = NODE_START_POS(cur);
-        size_t node_size = NODE_SIZE(cur);
-        size_t index_in_node = -1;
+    // released when it is unpinned
+    int ms = READ_ONCE(retain_ms);
+    if (ms <= 0 || pb->pins || pb->reclaim == pb->head) return 0;
 
-        if (node_first_pos >= start_pos) {
-            index_in_node = index(start_in_node, node_size, args);
-            if (index_in_node >= 0) {
-                target_pos = node_first_pos + index_in_node;
-                break;
-            }
-        } else if (node_first_pos + node_size > start_pos) {
-            int start_pos_in_node = start_pos - node_first_pos;
-            index_in_node = index(start_in_node + start_pos_in_node, 
-                    node_size - start_pos_in_node, args);
-            if (index_in_node >= 0) {
-                target_pos = start_pos + index_in_node;
-                break;
-            }
-        }
+    // the chunks behind the oldest one are consumed later, so they expire later
+    PPageNode node = (PPageNode) xa_load(&pb->chunks, pb->reclaim);
+    unsigned long expires = node->consumed_at + msecs_to_jiffies(ms);
+    return time_after(expires, jiffies) ? expires - jiffies : 1;
+}
+
+unsigned long pbuffer_reclaim(PPBuffer p)
+{
+    CONVERT(pb, p);
+
+    if (pb->pins) return 0;
+
+    _reclaim_chunks(pb, 0);
+    return pbuffer_reclaim_delay(p);
+}
+
+void init_pbuffer_iter(PPBuffer p, PPBufferIter it, size_t pos, size_t size)
+{
+    CONVERT(pb, p);
+
+    size_t available = pbuffer_size(p);
+    pos = MIN(pos, available);
+    size = MIN(size, available - pos);
+
+    it->buffer = p;
+    it->pos = atomic64_read(&pb->start_offset) + pos;
+    it->end = it->pos + size;
+    it->chunk = size ? _seek_chunk(pb, it->pos) : NULL;
+    pbuffer_pin(p);
+}
 
-        node_first_pos += node_size;
+int pbuffer_iter_next(PPBufferIter it, void ** ptr, size_t * len)
+{
+    CONVERT(pb, it->buffer);
+
+    PPageNode curr = (PPageNode) it->chunk;
+    if (!curr || it->pos >= it->end) return 0;
+
+    size_t pos_in_node = it->pos - curr->offset;
+    // the data of the range has all been written, so the end only matters 
+    // for the last chunk, which may be moving forward by the writer
+    while (pos_in_node >= READ_ONCE(curr->end_pos)) {
+        curr = (PPageNode) xa_load(&pb->chunks, curr->seq + 1);
+        if (!curr) return 0;
+        pos_in_node = it->pos - curr->offset;
     }
 
-    return target_pos;
+    *ptr = curr->page + pos_in_node;
+    *len = MIN(READ_ONCE(curr->end_pos) - pos_in_node, (size_t) (it->end - it->pos));
+    it->pos += *len;
+    it->chunk = curr;
+    return 1;
+}
+
+int pbuffer_iter_to_sg(PPBufferIter it, struct scatterlist * sg, int nents)
+{
+    void * ptr;
+    size_t len;
+    int count = 0;
+
+    if (nents <= 0) return 0;
+
+    sg_init_table(sg, nents);
+    // the chunks are physically contiguous folios, so one fragment is one entry
+    while (count < nents && pbuffer_iter_next(it, &ptr, &len)) {
+        sg_set_buf(&sg[count], ptr, len);
+        count++;
+    }
+    if (count > 0) {
+        sg_mark_end(&sg[count - 1]);
+    }
+    return count;
+}
+
+void release_pbuffer_iter(PPBufferIter it)
+{
+    pbuffer_unpin(it->buffer);
+    it->chunk = NULL;
 }
 
 void release_pbuffer(PPBuffer p)
 {
     CONVERT(pb, p);
-    while (!list_empty(&pb->pages)) {
-        PPageNode node = list_first_entry_or_null(&pb->pages, PageNode, node);
-        if (node) {
-            list_del(&node->node);
-            _release_page_node(node);
-        }
-    }
+    // nobody is able to reference the fragments any more
+    pb->head = pb->tail;
+    pb->pins = 0;
+    // the lock of the xarray is also taken by the tasklet when a chunk is appended, 
+    // so it is always taken with the bottom halves disabled
+    local_bh_disable();
+    _reclaim_chunks(pb, 1);
+    xa_destroy(&pb->chunks);
+    local_bh_enable();
+    // the chunks must be released before the memory cache and the module are gone
+    rcu_barrier();
 
     release_mem((void *) pb);
 }